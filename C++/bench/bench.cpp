@@ -0,0 +1,328 @@
+#include "../src/compiler.cpp"
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Runs `body` `iterations` times and returns the mean time in microseconds.
+template <typename F> double time_us(int iterations, F body) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    body();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count() /
+         iterations;
+}
+
+// let x0 = 1 in let x1 = x0 + 1 in ... let x{n-1} = x{n-2} + 1 in x{n-1}
+Expr::Expr *let_chain(int n) {
+  Expr::Expr *body = new Expr::Var("x" + std::to_string(n - 1));
+  for (int i = n - 1; i >= 1; i--) {
+    Expr::Add *add =
+        new Expr::Add(new Expr::Var("x" + std::to_string(i - 1)),
+                      new Expr::Cst(1));
+    body = new Expr::Let("x" + std::to_string(i), add, body);
+  }
+  return new Expr::Let("x0", new Expr::Cst(1), body);
+}
+
+// The printer to_str used before it was rewritten on top of print: repeated
+// concatenation of recursively returned temporaries.
+std::string legacy_to_str(Nameless::Expr *eptr) {
+  std::string str = "";
+  if (isinstanceof<Nameless::Cst>(eptr)) {
+    str += std::to_string(static_cast<Nameless::Cst *>(eptr)->val);
+  } else if (isinstanceof<Nameless::Add>(eptr)) {
+    Nameless::Add *add = static_cast<Nameless::Add *>(eptr);
+    str += legacy_to_str(add->e1) + " + " + legacy_to_str(add->e2);
+  } else if (isinstanceof<Nameless::Var>(eptr)) {
+    str += "Var(" +
+           std::to_string(static_cast<Nameless::Var *>(eptr)->index) + ")";
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    str += "let " + legacy_to_str(let->e1) + " in " + legacy_to_str(let->e2);
+  }
+  return str;
+}
+
+// Cst(0) + (Cst(1) + (... + Var(0))), `n` nodes in total
+Nameless::Expr *add_spine(int n) {
+  Nameless::Expr *spine = new Nameless::Var(0);
+  for (int i = 1; i + 1 < n; i += 2) {
+    spine = new Nameless::Add(new Nameless::Cst(i % 100), spine);
+  }
+  return spine;
+}
+
+// A complete tree of Lets and Adds of the given height over Var(0) and
+// constant leaves, closed by an outermost `let 1 in`.
+Nameless::Expr *balanced(int height, int depth = 1) {
+  if (height == 0) {
+    return depth % 2 == 0 ? (Nameless::Expr *)new Nameless::Var(depth - 1)
+                          : new Nameless::Cst(1);
+  }
+  if (height % 2 == 0) {
+    return new Nameless::Let(balanced(height - 1, depth),
+                             balanced(height - 1, depth + 1));
+  }
+  return new Nameless::Add(balanced(height - 1, depth),
+                           balanced(height - 1, depth));
+}
+
+// Bytes held by a tree, excluding allocator headers.
+size_t tree_bytes(Nameless::Expr *eptr) {
+  if (isinstanceof<Nameless::Add>(eptr)) {
+    Nameless::Add *add = static_cast<Nameless::Add *>(eptr);
+    return sizeof(Nameless::Add) + tree_bytes(add->e1) + tree_bytes(add->e2);
+  } else if (isinstanceof<Nameless::Mul>(eptr)) {
+    Nameless::Mul *mul = static_cast<Nameless::Mul *>(eptr);
+    return sizeof(Nameless::Mul) + tree_bytes(mul->e1) + tree_bytes(mul->e2);
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    return sizeof(Nameless::Let) + tree_bytes(let->e1) + tree_bytes(let->e2);
+  } else if (isinstanceof<Nameless::Fn>(eptr)) {
+    Nameless::Fn *fn = static_cast<Nameless::Fn *>(eptr);
+    return sizeof(Nameless::Fn) + tree_bytes(fn->expr);
+  } else if (isinstanceof<Nameless::App>(eptr)) {
+    Nameless::App *app = static_cast<Nameless::App *>(eptr);
+    size_t total = sizeof(Nameless::App) + tree_bytes(app->expr) +
+                   app->arguments.capacity() * sizeof(Nameless::Expr *);
+    for (Nameless::Expr *argument : app->arguments) {
+      total += tree_bytes(argument);
+    }
+    return total;
+  } else if (isinstanceof<Nameless::Var>(eptr)) {
+    return sizeof(Nameless::Var);
+  }
+  return sizeof(Nameless::Cst);
+}
+
+long sum_constants(Nameless::Expr *eptr) {
+  if (isinstanceof<Nameless::Cst>(eptr)) {
+    return static_cast<Nameless::Cst *>(eptr)->val;
+  } else if (isinstanceof<Nameless::Add>(eptr)) {
+    Nameless::Add *add = static_cast<Nameless::Add *>(eptr);
+    return sum_constants(add->e1) + sum_constants(add->e2);
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    return sum_constants(let->e1) + sum_constants(let->e2);
+  }
+  return 0;
+}
+
+long sum_constants(const Flat::Pool &pool, uint32_t node) {
+  switch (pool.kind[node]) {
+  case Flat::CST:
+    return pool.operand[node];
+  case Flat::ADD:
+  case Flat::LET:
+    return sum_constants(pool, pool.first[node]) +
+           sum_constants(pool, pool.second[node]);
+  }
+  return 0;
+}
+
+// A complete tree of Adds of the given height over Cst(1)
+Nameless::Expr *add_tree(int height) {
+  if (height == 0) {
+    return new Nameless::Cst(1);
+  }
+  return new Nameless::Add(add_tree(height - 1), add_tree(height - 1));
+}
+
+int main() {
+
+  {
+    std::cout << "========== Bytecode cold start ==========" << std::endl;
+    const int n = 2000;
+    const int iterations = 20;
+    Expr::Expr *program = let_chain(n);
+
+    int compiled_result = 0;
+    double recompile = time_us(iterations, [&]() {
+      Nameless::Expr *nameless = Compiler::lowerFromExprToNameless(program, {});
+      Instruction::InstrPtrs instrs =
+          Compiler::lowerFromNamelessToInstruction(nameless, {});
+      compiled_result = Instruction::eval(instrs, {});
+    });
+
+    Nameless::Expr *nameless = Compiler::lowerFromExprToNameless(program, {});
+    Bytecode::write("bench.scbc",
+                    Bytecode::serialize(Compiler::lowerFromNamelessToInstruction(
+                        nameless, {})));
+    int mapped_result = 0;
+    double cold_start = time_us(iterations, [&]() {
+      Bytecode::MappedFile file("bench.scbc");
+      mapped_result = Bytecode::eval(file.program(), {});
+    });
+    std::remove("bench.scbc");
+
+    std::cout << n << "-let program, results " << compiled_result << " / "
+              << mapped_result << std::endl;
+    std::cout << "recompile + eval:    " << recompile << " us" << std::endl;
+    std::cout << "mmap load + eval:    " << cold_start << " us" << std::endl;
+  }
+
+  {
+    std::cout << "========== Printing ==========" << std::endl;
+    for (int n : {10000, 20000, 40000}) {
+      Nameless::Expr *spine = add_spine(n);
+      double legacy = time_us(3, [&]() { legacy_to_str(spine); });
+      double streaming = time_us(3, [&]() { Nameless::to_str(spine); });
+      std::cout << n << " nodes: legacy to_str " << legacy
+                << " us, streaming to_str " << streaming << " us" << std::endl;
+    }
+    for (int n : {100000, 1000000}) {
+      Nameless::Expr *spine = add_spine(n);
+      std::string buffer;
+      double streaming = time_us(3, [&]() {
+        std::ostringstream oss;
+        Nameless::print(oss, spine);
+        buffer = oss.str();
+      });
+      std::cout << n << " nodes: streaming print " << streaming << " us ("
+                << buffer.size() << " bytes)" << std::endl;
+    }
+  }
+  {
+    std::cout << "========== Inlining ==========" << std::endl;
+    // let b = 1 in let c = 2 * 3 in let a = fn(x, y){x + y} in a(b, c)
+    Expr::Fn *fn = new Expr::Fn(
+        std::vector<std::string>{"x", "y"},
+        new Expr::Add(new Expr::Var("x"), new Expr::Var("y")));
+    Expr::App *app = new Expr::App(
+        new Expr::Var("a"), std::vector<Expr::STRING_OR_EXPR>{"b", "c"});
+    Expr::Let *program = new Expr::Let(
+        "b", new Expr::Cst(1),
+        new Expr::Let("c", new Expr::Mul(new Expr::Cst(2), new Expr::Cst(3)),
+                      new Expr::Let("a", fn, app)));
+    Nameless::Expr *original = Compiler::lowerFromExprToNameless(program, {});
+    Nameless::Expr *inlined = Optimizer::inlineClosures(original, 0);
+
+    const int iterations = 200000;
+    for (Nameless::Expr *variant : {original, inlined}) {
+      uint64_t allocated = Nameless::heap.stats.allocated;
+      double per_eval = time_us(
+          iterations, [&]() { Nameless::eval_final(variant, {}); });
+      std::cout << (variant == original ? "original: " : "inlined:  ")
+                << per_eval * 1000 << " ns/eval, "
+                << (double)(Nameless::heap.stats.allocated - allocated) /
+                       iterations
+                << " values/eval  \"" << Nameless::to_str(variant) << "\""
+                << std::endl;
+    }
+  }
+  {
+    std::cout << "========== Checked vs verified ==========" << std::endl;
+    const int n = 2000;
+    const int iterations = 50;
+    Expr::Expr *program = let_chain(n);
+    Nameless::Expr *nameless = Compiler::lowerFromExprToNameless(program, {});
+    Instruction::InstrPtrs instrs =
+        Compiler::lowerFromNamelessToInstruction(nameless, {});
+    Expr::typecheck(program, {});
+    Nameless::typecheck(nameless, {});
+    size_t max_depth = Instruction::verify(instrs);
+
+    double expr_checked =
+        time_us(iterations, [&]() { Expr::eval_final(program, {}); });
+    double expr_verified =
+        time_us(iterations, [&]() { Expr::eval_final_verified(program, {}); });
+    double nameless_checked =
+        time_us(iterations, [&]() { Nameless::eval_final(nameless, {}); });
+    double nameless_verified = time_us(
+        iterations, [&]() { Nameless::eval_final_verified(nameless, {}); });
+    double instr_checked =
+        time_us(iterations, [&]() { Instruction::eval(instrs, {}); });
+    double instr_verified = time_us(iterations, [&]() {
+      Instruction::eval_verified(instrs, {}, max_depth);
+    });
+    std::cout << n << "-let program" << std::endl;
+    std::cout << "Expr:        checked " << expr_checked << " us, verified "
+              << expr_verified << " us" << std::endl;
+    std::cout << "Nameless:    checked " << nameless_checked
+              << " us, verified " << nameless_verified << " us" << std::endl;
+    std::cout << "Instruction: checked " << instr_checked << " us, verified "
+              << instr_verified << " us" << std::endl;
+  }
+  {
+    std::cout << "========== Flat node pool ==========" << std::endl;
+    Nameless::Expr *tree =
+        new Nameless::Let(new Nameless::Cst(1), balanced(20));
+    Flat::Pool pool;
+    uint32_t root = Flat::fromNameless(pool, tree);
+    double nodes = pool.size();
+    std::cout << pool.size() << " nodes: tree " << tree_bytes(tree) / nodes
+              << " bytes/node (plus allocator headers), pool "
+              << pool.bytes() / nodes << " bytes/node" << std::endl;
+
+    long tree_sum = 0, flat_sum = 0, scan_sum = 0;
+    double tree_walk = time_us(5, [&]() { tree_sum = sum_constants(tree); });
+    double flat_walk =
+        time_us(5, [&]() { flat_sum = sum_constants(pool, root); });
+    double flat_scan = time_us(5, [&]() {
+      scan_sum = 0;
+      for (size_t i = 0; i < pool.size(); i++) {
+        if (pool.kind[i] == Flat::CST) {
+          scan_sum += pool.operand[i];
+        }
+      }
+    });
+    std::cout << "sum of constants " << tree_sum << " / " << flat_sum << " / "
+              << scan_sum << std::endl;
+    std::cout << "tree walk:  " << tree_walk << " us" << std::endl;
+    std::cout << "flat walk:  " << flat_walk << " us" << std::endl;
+    std::cout << "flat scan:  " << flat_scan << " us" << std::endl;
+
+    int tree_result = 0, flat_result = 0;
+    double tree_eval =
+        time_us(3, [&]() { tree_result = Nameless::eval_final(tree, {}); });
+    double flat_eval = time_us(
+        3, [&]() { flat_result = Flat::eval_final(pool, root, {}); });
+    std::cout << "eval " << tree_result << " / " << flat_result << std::endl;
+    std::cout << "tree eval:  " << tree_eval << " us" << std::endl;
+    std::cout << "flat eval:  " << flat_eval << " us" << std::endl;
+  }
+  {
+    std::cout << "========== Dead bindings and call by need =========="
+              << std::endl;
+    const int bindings = 8;
+    const int height = 14;
+    const int iterations = 10;
+    // let b0 = big in ... let b7 = big in b0 + 1
+    Nameless::Expr *unused = new Nameless::Add(new Nameless::Var(0),
+                                               new Nameless::Cst(1));
+    for (int i = 0; i < bindings; i++) {
+      unused = new Nameless::Let(add_tree(height), unused);
+    }
+    // let k = fn(x, y){y} in k(big, 1)
+    Nameless::Expr *ignored = new Nameless::Let(
+        new Nameless::Fn(new Nameless::Var(1), 2),
+        new Nameless::App(new Nameless::Var(0),
+                          std::vector<Nameless::Expr *>{add_tree(height),
+                                                        new Nameless::Cst(1)}));
+    for (Nameless::Expr *program : {unused, ignored}) {
+      Nameless::Expr *live = Optimizer::eliminateDeadLets(program, 0);
+      int eager_result = 0, live_result = 0, lazy_result = 0;
+      double eager = time_us(iterations, [&]() {
+        eager_result = Nameless::eval_final(program, {});
+      });
+      double eliminated = time_us(iterations, [&]() {
+        live_result = Nameless::eval_final(live, {});
+      });
+      double lazy = time_us(iterations, [&]() {
+        lazy_result = Nameless::eval_final_lazy(program, {});
+      });
+      std::cout << (program == unused
+                        ? std::to_string(bindings) + " bindings, 1 read"
+                        : std::string("1 ignored argument"))
+                << ", " << (1 << height) << " leaves each, results "
+                << eager_result << " / " << live_result << " / "
+                << lazy_result << std::endl;
+      std::cout << "eager:                " << eager << " us" << std::endl;
+      std::cout << "dead lets eliminated: " << eliminated << " us" << std::endl;
+      std::cout << "lazy:                 " << lazy << " us" << std::endl;
+    }
+  }
+}
\ No newline at end of file
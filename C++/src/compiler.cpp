@@ -1,6 +1,18 @@
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
 #include <list>
+#include <map>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -14,6 +26,213 @@ template <typename Base, typename T> bool isinstanceof(const T *t) {
   return dynamic_cast<const Base *>(t) != nullptr;
 }
 
+// Opt-in runtime profiling, enabled by compiling with SC_PROFILE. When it is
+// off every PROFILE_* macro expands to nothing.
+#ifdef SC_PROFILE
+#include <chrono>
+#include <map>
+
+namespace Profile {
+
+class NodeStat {
+public:
+  const char *interp = "";
+  const char *kind = "";
+  uint64_t count = 0;
+};
+
+class ClosureStat {
+public:
+  const char *interp = "";
+  uint64_t calls = 0;
+  // inclusive of nested calls
+  uint64_t nanoseconds = 0;
+};
+
+// keyed by the address of the source node (or instruction)
+std::unordered_map<const void *, NodeStat> nodes;
+// keyed by the address of the closure's body
+std::unordered_map<const void *, ClosureStat> closures;
+// "interp.kind" -> number of values allocated
+std::map<std::string, uint64_t> allocations;
+// "interp.stack" or "interp.env" -> maximum observed depth
+std::map<std::string, size_t> max_depth;
+
+void reset() {
+  nodes.clear();
+  closures.clear();
+  allocations.clear();
+  max_depth.clear();
+}
+
+void node(const char *interp, const char *kind, const void *node) {
+  NodeStat &stat = nodes[node];
+  stat.interp = interp;
+  stat.kind = kind;
+  stat.count++;
+}
+
+void alloc(const char *interp, const char *kind) {
+  allocations[std::string(interp) + "." + kind]++;
+}
+
+void depth(const char *interp, const char *what, size_t depth) {
+  size_t &max = max_depth[std::string(interp) + "." + what];
+  max = std::max(max, depth);
+}
+
+class ClosureTimer {
+public:
+  ClosureTimer(const char *interp, const void *body)
+      : interp(interp), body(body),
+        start(std::chrono::steady_clock::now()) {}
+  ~ClosureTimer() {
+    auto end = std::chrono::steady_clock::now();
+    ClosureStat &stat = closures[body];
+    stat.interp = interp;
+    stat.calls++;
+    stat.nanoseconds +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count();
+  }
+  const char *interp;
+  const void *body;
+  std::chrono::steady_clock::time_point start;
+};
+
+std::string node_id(const void *node) {
+  std::ostringstream oss;
+  oss << node;
+  return oss.str();
+}
+
+// executions per interpreter and node kind (or opcode)
+std::map<std::string, std::map<std::string, uint64_t>> kind_counts() {
+  std::map<std::string, std::map<std::string, uint64_t>> counts;
+  for (auto &entry : nodes) {
+    counts[entry.second.interp][entry.second.kind] += entry.second.count;
+  }
+  return counts;
+}
+
+std::string to_json() {
+  std::ostringstream oss;
+  oss << "{\"executions\": {";
+  bool first_interp = true;
+  for (auto &interp : kind_counts()) {
+    oss << (first_interp ? "" : ", ") << "\"" << interp.first << "\": {";
+    first_interp = false;
+    bool first_kind = true;
+    for (auto &kind : interp.second) {
+      oss << (first_kind ? "" : ", ") << "\"" << kind.first
+          << "\": " << kind.second;
+      first_kind = false;
+    }
+    oss << "}";
+  }
+  oss << "}, \"max_depth\": {";
+  bool first = true;
+  for (auto &entry : max_depth) {
+    oss << (first ? "" : ", ") << "\"" << entry.first << "\": " << entry.second;
+    first = false;
+  }
+  oss << "}, \"allocations\": {";
+  first = true;
+  for (auto &entry : allocations) {
+    oss << (first ? "" : ", ") << "\"" << entry.first << "\": " << entry.second;
+    first = false;
+  }
+  oss << "}, \"closures\": [";
+  first = true;
+  for (auto &entry : closures) {
+    oss << (first ? "" : ", ") << "{\"interp\": \"" << entry.second.interp
+        << "\", \"body\": \"" << node_id(entry.first)
+        << "\", \"calls\": " << entry.second.calls
+        << ", \"ns\": " << entry.second.nanoseconds << "}";
+    first = false;
+  }
+  oss << "]}";
+  return oss.str();
+}
+
+} // namespace Profile
+
+#define PROFILE_NODE(INTERP, KIND, NODE) Profile::node(INTERP, KIND, NODE)
+#define PROFILE_ALLOC(INTERP, KIND) Profile::alloc(INTERP, KIND)
+#define PROFILE_DEPTH(INTERP, WHAT, DEPTH) Profile::depth(INTERP, WHAT, DEPTH)
+#define PROFILE_CLOSURE(INTERP, BODY)                                          \
+  Profile::ClosureTimer profile_closure_timer(INTERP, BODY)
+#else
+#define PROFILE_NODE(INTERP, KIND, NODE)
+#define PROFILE_ALLOC(INTERP, KIND)
+#define PROFILE_DEPTH(INTERP, WHAT, DEPTH)
+#define PROFILE_CLOSURE(INTERP, BODY)
+#endif
+
+// Storage for the runtime values of an interpreter. Values are reclaimed by
+// region: release(mark) frees, in one sweep, every value allocated since
+// mark() returned `mark`. eval_final wraps each evaluation in a Region, so
+// long-running services evaluating programs one after another stay at a flat
+// heap size.
+template <typename V> class Heap {
+public:
+  class Stats {
+  public:
+    uint64_t allocated = 0;
+    uint64_t freed = 0;
+    size_t live = 0;
+    size_t peak_live = 0;
+    // shallow size of the live values, excluding their envs' storage
+    size_t live_bytes = 0;
+  };
+
+  // Releases everything allocated during its lifetime.
+  class Region {
+  public:
+    Region(Heap &heap) : heap(heap), mark(heap.mark()) {}
+    Region(const Region &) = delete;
+    Region &operator=(const Region &) = delete;
+    ~Region() { heap.release(mark); }
+    Heap &heap;
+    size_t mark;
+  };
+
+  Heap() {}
+  Heap(const Heap &) = delete;
+  Heap &operator=(const Heap &) = delete;
+  ~Heap() { release(0); }
+
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    T *value = new T(std::forward<Args>(args)...);
+    objects.push_back(std::make_pair(static_cast<V *>(value), sizeof(T)));
+    stats.allocated++;
+    stats.live++;
+    stats.live_bytes += sizeof(T);
+    if (stats.live > stats.peak_live) {
+      stats.peak_live = stats.live;
+    }
+    return value;
+  }
+
+  size_t mark() const { return objects.size(); }
+
+  void release(size_t mark) {
+    ASSERT(mark <= objects.size(), "Heap mark is beyond the heap's top");
+    while (objects.size() > mark) {
+      delete objects.back().first;
+      stats.freed++;
+      stats.live--;
+      stats.live_bytes -= objects.back().second;
+      objects.pop_back();
+    }
+  }
+
+  Stats stats;
+
+private:
+  std::vector<std::pair<V *, size_t>> objects;
+};
+
 namespace Expr {
 class Expr {
 public:
@@ -117,57 +336,83 @@ public:
   Expr *expr;
 };
 
-Vint *vadd(Value *v1, Value *v2) {
-  if (isinstanceof<Vint>(v1) && isinstanceof<Vint>(v2)) {
+// Values produced by eval are owned by this heap
+Heap<Value> heap;
+
+// Verified skips the type check, for programs accepted by typecheck
+template <bool Verified = false> Vint *vadd(Value *v1, Value *v2) {
+  if (Verified || (isinstanceof<Vint>(v1) && isinstanceof<Vint>(v2))) {
     Vint *vint1 = static_cast<Vint *>(v1);
     Vint *vint2 = static_cast<Vint *>(v2);
-    return new Vint(vint1->val + vint2->val);
+    PROFILE_ALLOC("Expr", "Vint");
+    return heap.make<Vint>(vint1->val + vint2->val);
   }
   ALARM("vadd type error");
 }
 
-Vint *vmul(Value *v1, Value *v2) {
-  if (isinstanceof<Vint>(v1) && isinstanceof<Vint>(v2)) {
+template <bool Verified = false> Vint *vmul(Value *v1, Value *v2) {
+  if (Verified || (isinstanceof<Vint>(v1) && isinstanceof<Vint>(v2))) {
     Vint *vint1 = static_cast<Vint *>(v1);
     Vint *vint2 = static_cast<Vint *>(v2);
-    return new Vint(vint1->val * vint2->val);
+    PROFILE_ALLOC("Expr", "Vint");
+    return heap.make<Vint>(vint1->val * vint2->val);
   }
   ALARM("vmul type error");
 }
 
-Value *eval(Expr *eptr, Env env) {
+// With Verified set every dynamic check is skipped, which is only safe for
+// programs accepted by typecheck.
+template <bool Verified> Value *eval_impl(Expr *eptr, Env env) {
+  PROFILE_DEPTH("Expr", "env", env.size());
   if (isinstanceof<Cst>(eptr)) {
     Cst *cst = static_cast<Cst *>(eptr);
-    return new Vint(cst->val);
+    PROFILE_NODE("Expr", "Cst", eptr);
+    PROFILE_ALLOC("Expr", "Vint");
+    return heap.make<Vint>(cst->val);
   } else if (isinstanceof<Add>(eptr)) {
     Add *add = static_cast<Add *>(eptr);
-    return vadd(eval(add->e1, env), eval(add->e2, env));
+    PROFILE_NODE("Expr", "Add", eptr);
+    return vadd<Verified>(eval_impl<Verified>(add->e1, env),
+                          eval_impl<Verified>(add->e2, env));
   } else if (isinstanceof<Mul>(eptr)) {
     Mul *mul = static_cast<Mul *>(eptr);
-    return vmul(eval(mul->e1, env), eval(mul->e2, env));
+    PROFILE_NODE("Expr", "Mul", eptr);
+    return vmul<Verified>(eval_impl<Verified>(mul->e1, env),
+                          eval_impl<Verified>(mul->e2, env));
   } else if (isinstanceof<Var>(eptr)) {
     Var *var = static_cast<Var *>(eptr);
+    PROFILE_NODE("Expr", "Var", eptr);
     auto pos = env.find(var->name);
-    ASSERT(pos != env.end(), "Cannot find key " + var->name);
+    if constexpr (!Verified) {
+      ASSERT(pos != env.end(), "Cannot find key " + var->name);
+    }
     return pos->second;
   } else if (isinstanceof<Let>(eptr)) {
     Let *let = static_cast<Let *>(eptr);
-    Value *e1_val = eval(let->e1, env);
+    PROFILE_NODE("Expr", "Let", eptr);
+    Value *e1_val = eval_impl<Verified>(let->e1, env);
     env.insert(std::make_pair(let->name, e1_val));
-    return eval(let->e2, env);
+    return eval_impl<Verified>(let->e2, env);
   } else if (isinstanceof<Fn>(eptr)) {
     Fn *fn = static_cast<Fn *>(eptr);
-    return new Vclosure(env, fn->params, fn->expr);
+    PROFILE_NODE("Expr", "Fn", eptr);
+    PROFILE_ALLOC("Expr", "Vclosure");
+    return heap.make<Vclosure>(env, fn->params, fn->expr);
   } else if (isinstanceof<App>(eptr)) {
     App *app = static_cast<App *>(eptr);
-    Value *fn_val = eval(app->fn, env);
-    ASSERT(isinstanceof<Vclosure>(fn_val),
-           "The evaluation result of function is not closure.");
+    PROFILE_NODE("Expr", "App", eptr);
+    Value *fn_val = eval_impl<Verified>(app->fn, env);
+    if constexpr (!Verified) {
+      ASSERT(isinstanceof<Vclosure>(fn_val),
+             "The evaluation result of function is not closure.");
+    }
     Vclosure *fn_val_closure = static_cast<Vclosure *>(fn_val);
     Env closure_env = fn_val_closure->env;
     // renew env by assigning parameters the values of arguments
-    ASSERT(app->arguments.size() == fn_val_closure->params.size(),
-           "arguments' number does not equal to parameters' number");
+    if constexpr (!Verified) {
+      ASSERT(app->arguments.size() == fn_val_closure->params.size(),
+             "arguments' number does not equal to parameters' number");
+    }
     size_t arg_size = app->arguments.size();
     for (size_t i = 0; i < arg_size; i++) {
       STRING_OR_EXPR argument = app->arguments[i];
@@ -181,19 +426,29 @@ Value *eval(Expr *eptr, Env env) {
       // argument is a temporary value, e.g., Add(Cst(1), Cst(2))
       else {
         Expr *argument_expr = std::get<Expr *>(argument);
-        Value *arg_val = eval(argument_expr, closure_env);
+        Value *arg_val = eval_impl<Verified>(argument_expr, closure_env);
         std::string parameter = fn_val_closure->params[i];
         closure_env.insert(std::make_pair(parameter, arg_val));
       }
     }
-    return eval(fn_val_closure->expr, closure_env);
+    PROFILE_CLOSURE("Expr", fn_val_closure->expr);
+    return eval_impl<Verified>(fn_val_closure->expr, closure_env);
   } else {
     ALARM("Unsupported expr in Expr::eval: " + eptr->expr_name());
   }
 }
 
-// this eval promises to get a int value
+Value *eval(Expr *eptr, Env env) { return eval_impl<false>(eptr, env); }
+
+// eval for programs accepted by typecheck
+Value *eval_verified(Expr *eptr, Env env) {
+  return eval_impl<true>(eptr, env);
+}
+
+// this eval promises to get a int value, and releases every value allocated
+// during the evaluation before returning
 int eval_final(Expr *eptr, Env env) {
+  Heap<Value>::Region region(heap);
   Value *value = eval(eptr, env);
   ASSERT(isinstanceof<Vint>(value),
          "Value is not of type Vint in function eval_final");
@@ -201,52 +456,243 @@ int eval_final(Expr *eptr, Env env) {
   return int_value->val;
 }
 
-std::string to_str(Expr *eptr) {
-  std::string str = "";
-  if (isinstanceof<Cst>(eptr)) {
-    Cst *cst = static_cast<Cst *>(eptr);
-    str += std::to_string(cst->val);
-  } else if (isinstanceof<Add>(eptr)) {
+// eval_final for programs whose typecheck gives Tint
+int eval_final_verified(Expr *eptr, Env env) {
+  Heap<Value>::Region region(heap);
+  return static_cast<Vint *>(eval_impl<true>(eptr, env))->val;
+}
+
+std::string to_str(Expr *eptr);
+
+class Type;
+typedef std::unordered_map<std::string, Type *> TEnv;
+
+class Type {
+public:
+  virtual ~Type() {}
+};
+
+class Tint : public Type {};
+
+// Parameters carry no type in the source, so the body of a closure is
+// checked once for each list of argument types it is applied to, together
+// with the env types captured here.
+class Tclosure : public Type {
+public:
+  Tclosure(TEnv env, Fn *fn) : env(env), fn(fn) {}
+  TEnv env;
+  Fn *fn;
+};
+
+int size(Expr *eptr) {
+  if (isinstanceof<Add>(eptr)) {
     Add *add = static_cast<Add *>(eptr);
-    str += to_str(add->e1) + " + " + to_str(add->e2);
+    return 1 + size(add->e1) + size(add->e2);
   } else if (isinstanceof<Mul>(eptr)) {
     Mul *mul = static_cast<Mul *>(eptr);
-    str += to_str(mul->e1) + " * " + to_str(mul->e2);
+    return 1 + size(mul->e1) + size(mul->e2);
+  } else if (isinstanceof<Let>(eptr)) {
+    Let *let = static_cast<Let *>(eptr);
+    return 1 + size(let->e1) + size(let->e2);
+  } else if (isinstanceof<Fn>(eptr)) {
+    return 1 + size(static_cast<Fn *>(eptr)->expr);
+  } else if (isinstanceof<App>(eptr)) {
+    App *app = static_cast<App *>(eptr);
+    int total = 1 + size(app->fn);
+    for (STRING_OR_EXPR argument : app->arguments) {
+      total += is_string(argument) ? 1 : size(std::get<Expr *>(argument));
+    }
+    return total;
+  }
+  return 1;
+}
+
+// Types built during one typecheck. Closure types are shared, so equal
+// types are the same pointer and an env of types can key the tables.
+class TypeCache {
+public:
+  typedef std::map<std::string, Type *> Key;
+  TypeCache(int limit) : limit(limit) {}
+  Tint *tint = new Tint();
+  std::map<std::pair<Fn *, Key>, Tclosure *> closures;
+  // type of each body checked, keyed by the env it was checked in;
+  // nullptr while that check is in progress
+  std::map<std::pair<Fn *, Key>, Type *> bodies;
+  // number of checks of each Fn's body in progress, and the bound on it.
+  // Closure types can keep growing when eval does not terminate, so a
+  // nested check is not always an exact repeat. The bound is the size of
+  // the program, which a body only reaches when its env types keep
+  // changing as it nests.
+  std::unordered_map<Fn *, int> active;
+  int limit;
+};
+
+// Infers the type of eptr in an env of types `tenv`, following eval's
+// scoping exactly. Throws std::logic_error on any program that eval could
+// reject at run time; the others can run through eval_verified. Integers
+// never decide control flow, so a body checked again in the same env while
+// its check is in progress means eval would never return, and is rejected.
+Type *typecheck(Expr *eptr, TEnv tenv, TypeCache &cache) {
+  if (isinstanceof<Cst>(eptr)) {
+    return cache.tint;
+  } else if (isinstanceof<Add>(eptr) || isinstanceof<Mul>(eptr)) {
+    bool is_add = isinstanceof<Add>(eptr);
+    Expr *e1 = is_add ? static_cast<Add *>(eptr)->e1
+                      : static_cast<Mul *>(eptr)->e1;
+    Expr *e2 = is_add ? static_cast<Add *>(eptr)->e2
+                      : static_cast<Mul *>(eptr)->e2;
+    ASSERT(isinstanceof<Tint>(typecheck(e1, tenv, cache)) &&
+               isinstanceof<Tint>(typecheck(e2, tenv, cache)),
+           std::string(is_add ? "vadd" : "vmul") + " type error: " +
+               to_str(eptr));
+    return cache.tint;
   } else if (isinstanceof<Var>(eptr)) {
     Var *var = static_cast<Var *>(eptr);
-    str += var->name;
+    auto pos = tenv.find(var->name);
+    ASSERT(pos != tenv.end(), "Cannot find key " + var->name);
+    return pos->second;
   } else if (isinstanceof<Let>(eptr)) {
     Let *let = static_cast<Let *>(eptr);
-    str +=
-        "let " + let->name + " = " + to_str(let->e1) + " in " + to_str(let->e2);
+    Type *e1_type = typecheck(let->e1, tenv, cache);
+    tenv.insert(std::make_pair(let->name, e1_type));
+    return typecheck(let->e2, tenv, cache);
   } else if (isinstanceof<Fn>(eptr)) {
-    str += "Fn(";
     Fn *fn = static_cast<Fn *>(eptr);
-    for (std::string &parameter : fn->params) {
-      str += parameter + ", ";
-    }
-    str = str.substr(0, str.size() - 2);
-    str += ")";
-    str += "{";
-    str += to_str(fn->expr);
-    str += "}";
+    Tclosure *&closure = cache.closures[std::make_pair(
+        fn, TypeCache::Key(tenv.begin(), tenv.end()))];
+    if (closure == nullptr) {
+      closure = new Tclosure(tenv, fn);
+    }
+    return closure;
   } else if (isinstanceof<App>(eptr)) {
     App *app = static_cast<App *>(eptr);
-    str += to_str(app->fn);
-    str += "(";
-    for (auto &argument : app->arguments) {
+    Type *fn_type = typecheck(app->fn, tenv, cache);
+    ASSERT(isinstanceof<Tclosure>(fn_type),
+           "Application of a non-closure: " + to_str(eptr));
+    Tclosure *closure = static_cast<Tclosure *>(fn_type);
+    ASSERT(app->arguments.size() == closure->fn->params.size(),
+           "arguments' number does not equal to parameters' number: " +
+               to_str(eptr));
+    TEnv closure_tenv = closure->env;
+    for (size_t i = 0; i < app->arguments.size(); i++) {
+      STRING_OR_EXPR argument = app->arguments[i];
+      Type *arg_type;
       if (is_string(argument)) {
-        str += std::get<std::string>(argument) + ", ";
+        auto pos = closure_tenv.find(std::get<std::string>(argument));
+        ASSERT(pos != closure_tenv.end(),
+               "Cannot find key " + std::get<std::string>(argument));
+        arg_type = pos->second;
       } else {
-        str += to_str(std::get<Expr *>(argument)) + ", ";
+        arg_type = typecheck(std::get<Expr *>(argument), closure_tenv, cache);
       }
+      closure_tenv.insert(std::make_pair(closure->fn->params[i], arg_type));
     }
-    str = str.substr(0, str.size() - 2);
-    str += ")";
-  } else {
-    ALARM("Unsupported expr in Expr::to_str: " + eptr->expr_name());
+    auto key = std::make_pair(
+        closure->fn, TypeCache::Key(closure_tenv.begin(), closure_tenv.end()));
+    auto pos = cache.bodies.find(key);
+    if (pos != cache.bodies.end()) {
+      ASSERT(pos->second != nullptr,
+             "Application does not terminate: " + to_str(eptr));
+      return pos->second;
+    }
+    ASSERT(cache.active[closure->fn] < cache.limit,
+           "Applications of one function nest too deeply to typecheck: " +
+               to_str(eptr));
+    cache.bodies[key] = nullptr;
+    cache.active[closure->fn]++;
+    Type *body_type = typecheck(closure->fn->expr, closure_tenv, cache);
+    cache.active[closure->fn]--;
+    cache.bodies[key] = body_type;
+    return body_type;
   }
-  return str;
+  ALARM("Unsupported expr in Expr::typecheck: " + eptr->expr_name());
+}
+
+Type *typecheck(Expr *eptr, TEnv tenv) {
+  TypeCache cache(size(eptr));
+  return typecheck(eptr, tenv, cache);
+}
+
+// Writes the text returned by to_str, in time linear in the size of the
+// tree. An explicit work list is used instead of recursion, so long spines
+// cannot overflow the call stack.
+void print(std::ostream &os, Expr *root) {
+  // each item is a node, a literal or a variable name to be written
+  struct Item {
+    Expr *eptr;
+    const char *text;
+    const std::string *name;
+  };
+  std::vector<Item> work = {{root, nullptr, nullptr}};
+  while (!work.empty()) {
+    Item item = work.back();
+    work.pop_back();
+    if (item.text != nullptr) {
+      os << item.text;
+      continue;
+    }
+    if (item.name != nullptr) {
+      os << *item.name;
+      continue;
+    }
+    Expr *eptr = item.eptr;
+    if (isinstanceof<Cst>(eptr)) {
+      Cst *cst = static_cast<Cst *>(eptr);
+      os << cst->val;
+    } else if (isinstanceof<Add>(eptr)) {
+      Add *add = static_cast<Add *>(eptr);
+      work.push_back({add->e2, nullptr, nullptr});
+      work.push_back({nullptr, " + ", nullptr});
+      work.push_back({add->e1, nullptr, nullptr});
+    } else if (isinstanceof<Mul>(eptr)) {
+      Mul *mul = static_cast<Mul *>(eptr);
+      work.push_back({mul->e2, nullptr, nullptr});
+      work.push_back({nullptr, " * ", nullptr});
+      work.push_back({mul->e1, nullptr, nullptr});
+    } else if (isinstanceof<Var>(eptr)) {
+      Var *var = static_cast<Var *>(eptr);
+      os << var->name;
+    } else if (isinstanceof<Let>(eptr)) {
+      Let *let = static_cast<Let *>(eptr);
+      os << "let " << let->name << " = ";
+      work.push_back({let->e2, nullptr, nullptr});
+      work.push_back({nullptr, " in ", nullptr});
+      work.push_back({let->e1, nullptr, nullptr});
+    } else if (isinstanceof<Fn>(eptr)) {
+      Fn *fn = static_cast<Fn *>(eptr);
+      os << "Fn(";
+      for (size_t i = 0; i < fn->params.size(); i++) {
+        os << (i == 0 ? "" : ", ") << fn->params[i];
+      }
+      os << "){";
+      work.push_back({nullptr, "}", nullptr});
+      work.push_back({fn->expr, nullptr, nullptr});
+    } else if (isinstanceof<App>(eptr)) {
+      App *app = static_cast<App *>(eptr);
+      work.push_back({nullptr, ")", nullptr});
+      for (size_t i = app->arguments.size(); i-- > 0;) {
+        STRING_OR_EXPR &argument = app->arguments[i];
+        if (is_string(argument)) {
+          work.push_back({nullptr, nullptr, &std::get<std::string>(argument)});
+        } else {
+          work.push_back({std::get<Expr *>(argument), nullptr, nullptr});
+        }
+        if (i != 0) {
+          work.push_back({nullptr, ", ", nullptr});
+        }
+      }
+      work.push_back({nullptr, "(", nullptr});
+      work.push_back({app->fn, nullptr, nullptr});
+    } else {
+      ALARM("Unsupported expr in Expr::print: " + eptr->expr_name());
+    }
+  }
+}
+
+std::string to_str(Expr *eptr) {
+  std::ostringstream oss;
+  print(oss, eptr);
+  return oss.str();
 }
 
 } // namespace Expr
@@ -298,8 +744,11 @@ public:
 
 class Fn : public Expr {
 public:
-  Fn(Expr *expr) : expr(expr) {}
+  Fn(Expr *expr, int arity) : expr(expr), arity(arity) {}
   Expr *expr;
+  // number of parameters, which occupy the env slots right after the
+  // captured env
+  int arity;
 };
 
 class App : public Expr {
@@ -333,59 +782,133 @@ public:
   Expr *expr;
 };
 
-Vint *vadd(Value *v1, Value *v2) {
-  if (isinstanceof<Vint>(v1) && isinstanceof<Vint>(v2)) {
+// A delayed Let right-hand side or argument of the lazy mode. It is
+// evaluated on its first Var access and the result is memoized.
+class Vthunk : public Value {
+public:
+  Vthunk(Env env, Expr *expr) : env(env), expr(expr), value(nullptr) {}
+  Env env;
+  Expr *expr;
+  Value *value;
+};
+
+// Values produced by eval are owned by this heap
+Heap<Value> heap;
+
+// Verified skips the type check, for programs accepted by typecheck
+template <bool Verified = false> Vint *vadd(Value *v1, Value *v2) {
+  if (Verified || (isinstanceof<Vint>(v1) && isinstanceof<Vint>(v2))) {
     Vint *vint1 = static_cast<Vint *>(v1);
     Vint *vint2 = static_cast<Vint *>(v2);
-    return new Vint(vint1->val + vint2->val);
+    PROFILE_ALLOC("Nameless", "Vint");
+    return heap.make<Vint>(vint1->val + vint2->val);
   }
   ALARM("vadd type error");
 }
 
-Vint *vmul(Value *v1, Value *v2) {
-  if (isinstanceof<Vint>(v1) && isinstanceof<Vint>(v2)) {
+template <bool Verified = false> Vint *vmul(Value *v1, Value *v2) {
+  if (Verified || (isinstanceof<Vint>(v1) && isinstanceof<Vint>(v2))) {
     Vint *vint1 = static_cast<Vint *>(v1);
     Vint *vint2 = static_cast<Vint *>(v2);
-    return new Vint(vint1->val * vint2->val);
+    PROFILE_ALLOC("Nameless", "Vint");
+    return heap.make<Vint>(vint1->val * vint2->val);
   }
   ALARM("vmul type error");
 }
 
 std::string to_str(Expr *eptr);
 
-Value *eval(Expr *eptr, Env env) {
+template <bool Verified, bool Lazy> Value *eval_impl(Expr *eptr, Env env);
+
+template <bool Verified> Value *force(Vthunk *thunk) {
+  if (thunk->value == nullptr) {
+    thunk->value = eval_impl<Verified, true>(thunk->expr, thunk->env);
+    // the env is no longer needed once the value is known
+    thunk->env = Env();
+  }
+  return thunk->value;
+}
+
+// Delays eptr in the lazy mode. Slots are shared rather than wrapped, and
+// constants and functions are cheap and cannot fail, so they are evaluated
+// at once.
+template <bool Verified> Value *delay(Expr *eptr, const Env &env) {
+  if (isinstanceof<Var>(eptr)) {
+    Var *var = static_cast<Var *>(eptr);
+    if constexpr (!Verified) {
+      ASSERT(var->index >= 0 && (size_t)var->index < env.size(),
+             "var " + std::to_string(var->index) +
+                 "'s index is out of env's scope (" +
+                 std::to_string(env.size()) + ")");
+    }
+    return env[var->index];
+  } else if (isinstanceof<Cst>(eptr) || isinstanceof<Fn>(eptr)) {
+    return eval_impl<Verified, true>(eptr, env);
+  }
+  PROFILE_ALLOC("Nameless", "Vthunk");
+  return heap.make<Vthunk>(env, eptr);
+}
+
+// With Verified set every dynamic check is skipped, which is only safe for
+// programs accepted by typecheck. With Lazy set Let-bound values and
+// arguments are passed by need.
+template <bool Verified, bool Lazy> Value *eval_impl(Expr *eptr, Env env) {
+  PROFILE_DEPTH("Nameless", "env", env.size());
   if (isinstanceof<Cst>(eptr)) {
     Cst *cst = static_cast<Cst *>(eptr);
-    return new Vint(cst->val);
+    PROFILE_NODE("Nameless", "Cst", eptr);
+    PROFILE_ALLOC("Nameless", "Vint");
+    return heap.make<Vint>(cst->val);
   } else if (isinstanceof<Add>(eptr)) {
     Add *add = static_cast<Add *>(eptr);
-    return vadd(eval(add->e1, env), eval(add->e2, env));
+    PROFILE_NODE("Nameless", "Add", eptr);
+    return vadd<Verified>(eval_impl<Verified, Lazy>(add->e1, env),
+                          eval_impl<Verified, Lazy>(add->e2, env));
   } else if (isinstanceof<Mul>(eptr)) {
     Mul *mul = static_cast<Mul *>(eptr);
-    return vmul(eval(mul->e1, env), eval(mul->e2, env));
+    PROFILE_NODE("Nameless", "Mul", eptr);
+    return vmul<Verified>(eval_impl<Verified, Lazy>(mul->e1, env),
+                          eval_impl<Verified, Lazy>(mul->e2, env));
   } else if (isinstanceof<Var>(eptr)) {
     Var *var = static_cast<Var *>(eptr);
-    ASSERT(env.size() > var->index, "var " + std::to_string(var->index) +
-                                        "'s index is out of env's scope (" +
-                                        std::to_string(env.size()) + ")");
-    return env[var->index];
+    PROFILE_NODE("Nameless", "Var", eptr);
+    if constexpr (!Verified) {
+      ASSERT(env.size() > var->index, "var " + std::to_string(var->index) +
+                                          "'s index is out of env's scope (" +
+                                          std::to_string(env.size()) + ")");
+    }
+    Value *value = env[var->index];
+    if constexpr (Lazy) {
+      if (isinstanceof<Vthunk>(value)) {
+        return force<Verified>(static_cast<Vthunk *>(value));
+      }
+    }
+    return value;
   } else if (isinstanceof<Let>(eptr)) {
     Let *let = static_cast<Let *>(eptr);
-    Value *e1_val = eval(let->e1, env);
+    PROFILE_NODE("Nameless", "Let", eptr);
+    Value *e1_val = Lazy ? delay<Verified>(let->e1, env)
+                         : eval_impl<Verified, Lazy>(let->e1, env);
     env.push_back(e1_val);
-    return eval(let->e2, env);
+    return eval_impl<Verified, Lazy>(let->e2, env);
   } else if (isinstanceof<Fn>(eptr)) {
     Fn *fn = static_cast<Fn *>(eptr);
-    return new Vclosure(env, fn->expr);
+    PROFILE_NODE("Nameless", "Fn", eptr);
+    PROFILE_ALLOC("Nameless", "Vclosure");
+    return heap.make<Vclosure>(env, fn->expr);
   } else if (isinstanceof<App>(eptr)) {
     App *app = static_cast<App *>(eptr);
-    Value *maybe_closure = eval(app->expr, env);
-    ASSERT(isinstanceof<Vclosure>(maybe_closure),
-           "Expression for application cannot be evaluated into Vclosure");
+    PROFILE_NODE("Nameless", "App", eptr);
+    Value *maybe_closure = eval_impl<Verified, Lazy>(app->expr, env);
+    if constexpr (!Verified) {
+      ASSERT(isinstanceof<Vclosure>(maybe_closure),
+             "Expression for application cannot be evaluated into Vclosure");
+    }
     Vclosure *closure = static_cast<Vclosure *>(maybe_closure);
     Env closure_env = closure->env;
     for (auto &argument : app->arguments) {
-      Value *arg_val = eval(argument, env);
+      Value *arg_val = Lazy ? delay<Verified>(argument, env)
+                            : eval_impl<Verified, Lazy>(argument, env);
       closure_env.push_back(arg_val);
     }
     // std::cout << "=====" << std::endl;
@@ -398,14 +921,32 @@ Value *eval(Expr *eptr, Env env) {
     //     std::cout << i << std::endl;
     //   }
     // }
-    return eval(closure->expr, closure_env);
+    PROFILE_CLOSURE("Nameless", closure->expr);
+    return eval_impl<Verified, Lazy>(closure->expr, closure_env);
   } else {
     ALARM("Unsupported expr in Nameless::eval: " + eptr->expr_name());
   }
 }
 
-// this eval promises to get a int value
+Value *eval(Expr *eptr, Env env) {
+  return eval_impl<false, false>(eptr, env);
+}
+
+// eval for programs accepted by typecheck
+Value *eval_verified(Expr *eptr, Env env) {
+  return eval_impl<true, false>(eptr, env);
+}
+
+// Call-by-need eval: a Let right-hand side or an argument is only evaluated
+// when its slot is first read. Never returns a Vthunk.
+Value *eval_lazy(Expr *eptr, Env env) {
+  return eval_impl<false, true>(eptr, env);
+}
+
+// this eval promises to get a int value, and releases every value allocated
+// during the evaluation before returning
 int eval_final(Expr *eptr, Env env) {
+  Heap<Value>::Region region(heap);
   Value *value = eval(eptr, env);
   ASSERT(isinstanceof<Vint>(value),
          "Value is not of type Vint in function eval_final");
@@ -413,42 +954,215 @@ int eval_final(Expr *eptr, Env env) {
   return int_value->val;
 }
 
-std::string to_str(Expr *eptr) {
-  std::string str = "";
-  if (isinstanceof<Cst>(eptr)) {
-    Cst *cst = static_cast<Cst *>(eptr);
-    str += std::to_string(cst->val);
-  } else if (isinstanceof<Add>(eptr)) {
+// eval_final for programs whose typecheck gives Tint
+int eval_final_verified(Expr *eptr, Env env) {
+  Heap<Value>::Region region(heap);
+  return static_cast<Vint *>(eval_impl<true, false>(eptr, env))->val;
+}
+
+// eval_final in the call-by-need mode
+int eval_final_lazy(Expr *eptr, Env env) {
+  Heap<Value>::Region region(heap);
+  Value *value = eval_lazy(eptr, env);
+  ASSERT(isinstanceof<Vint>(value),
+         "Value is not of type Vint in function eval_final_lazy");
+  return static_cast<Vint *>(value)->val;
+}
+
+class Type;
+typedef std::vector<Type *> TEnv;
+
+class Type {
+public:
+  virtual ~Type() {}
+};
+
+class Tint : public Type {};
+
+// A closure of fn->arity parameters. Parameters carry no type in the
+// source, so the body is checked once for each list of argument types it
+// is applied to, together with the env types captured here.
+class Tclosure : public Type {
+public:
+  Tclosure(TEnv env, Fn *fn) : env(env), fn(fn) {}
+  TEnv env;
+  Fn *fn;
+};
+
+int size(Expr *eptr) {
+  if (isinstanceof<Add>(eptr)) {
     Add *add = static_cast<Add *>(eptr);
-    str += to_str(add->e1) + " + " + to_str(add->e2);
+    return 1 + size(add->e1) + size(add->e2);
   } else if (isinstanceof<Mul>(eptr)) {
     Mul *mul = static_cast<Mul *>(eptr);
-    str += to_str(mul->e1) + " * " + to_str(mul->e2);
+    return 1 + size(mul->e1) + size(mul->e2);
+  } else if (isinstanceof<Let>(eptr)) {
+    Let *let = static_cast<Let *>(eptr);
+    return 1 + size(let->e1) + size(let->e2);
+  } else if (isinstanceof<Fn>(eptr)) {
+    return 1 + size(static_cast<Fn *>(eptr)->expr);
+  } else if (isinstanceof<App>(eptr)) {
+    App *app = static_cast<App *>(eptr);
+    int total = 1 + size(app->expr);
+    for (Expr *argument : app->arguments) {
+      total += size(argument);
+    }
+    return total;
+  }
+  return 1;
+}
+
+// Types built during one typecheck, shared and bounded as in
+// Expr::TypeCache.
+class TypeCache {
+public:
+  TypeCache(int limit) : limit(limit) {}
+  Tint *tint = new Tint();
+  std::map<std::pair<Fn *, TEnv>, Tclosure *> closures;
+  // type of each body checked, keyed by the env it was checked in;
+  // nullptr while that check is in progress
+  std::map<std::pair<Fn *, TEnv>, Type *> bodies;
+  // number of checks of each Fn's body in progress, and the bound on it
+  std::unordered_map<Fn *, int> active;
+  int limit;
+};
+
+// Infers the type of eptr in an env of types `tenv`. Throws
+// std::logic_error on any program that eval could reject at run time; the
+// others can run through eval_verified. Non-termination is detected as in
+// Expr::typecheck.
+Type *typecheck(Expr *eptr, TEnv tenv, TypeCache &cache) {
+  if (isinstanceof<Cst>(eptr)) {
+    return cache.tint;
+  } else if (isinstanceof<Add>(eptr) || isinstanceof<Mul>(eptr)) {
+    bool is_add = isinstanceof<Add>(eptr);
+    Expr *e1 = is_add ? static_cast<Add *>(eptr)->e1
+                      : static_cast<Mul *>(eptr)->e1;
+    Expr *e2 = is_add ? static_cast<Add *>(eptr)->e2
+                      : static_cast<Mul *>(eptr)->e2;
+    ASSERT(isinstanceof<Tint>(typecheck(e1, tenv, cache)) &&
+               isinstanceof<Tint>(typecheck(e2, tenv, cache)),
+           std::string(is_add ? "vadd" : "vmul") + " type error: " +
+               to_str(eptr));
+    return cache.tint;
   } else if (isinstanceof<Var>(eptr)) {
     Var *var = static_cast<Var *>(eptr);
-    str += "Var(" + std::to_string(var->index) + ")";
+    ASSERT(var->index >= 0 && (size_t)var->index < tenv.size(),
+           "var " + std::to_string(var->index) +
+               "'s index is out of env's scope (" +
+               std::to_string(tenv.size()) + ")");
+    return tenv[var->index];
   } else if (isinstanceof<Let>(eptr)) {
     Let *let = static_cast<Let *>(eptr);
-    str += "let " + to_str(let->e1) + " in " + to_str(let->e2);
+    tenv.push_back(typecheck(let->e1, tenv, cache));
+    return typecheck(let->e2, tenv, cache);
   } else if (isinstanceof<Fn>(eptr)) {
-    str += "Fn";
     Fn *fn = static_cast<Fn *>(eptr);
-    str += "{";
-    str += to_str(fn->expr);
-    str += "}";
+    Tclosure *&closure = cache.closures[std::make_pair(fn, tenv)];
+    if (closure == nullptr) {
+      closure = new Tclosure(tenv, fn);
+    }
+    return closure;
   } else if (isinstanceof<App>(eptr)) {
     App *app = static_cast<App *>(eptr);
-    str += to_str(app->expr);
-    str += "(";
-    for (auto &argument : app->arguments) {
-      str += to_str(argument) + ", ";
+    Type *fn_type = typecheck(app->expr, tenv, cache);
+    ASSERT(isinstanceof<Tclosure>(fn_type),
+           "Application of a non-closure: " + to_str(eptr));
+    Tclosure *closure = static_cast<Tclosure *>(fn_type);
+    // eval does not check arity, a mismatch shifts every later slot
+    ASSERT((int)app->arguments.size() == closure->fn->arity,
+           "arguments' number does not equal to parameters' number: " +
+               to_str(eptr));
+    TEnv closure_tenv = closure->env;
+    for (Expr *argument : app->arguments) {
+      closure_tenv.push_back(typecheck(argument, tenv, cache));
     }
-    str = str.substr(0, str.size() - 2);
-    str += ")";
-  } else {
-    ALARM("Unsupported expr in Nameless::to_str: " + eptr->expr_name());
+    auto key = std::make_pair(closure->fn, closure_tenv);
+    auto pos = cache.bodies.find(key);
+    if (pos != cache.bodies.end()) {
+      ASSERT(pos->second != nullptr,
+             "Application does not terminate: " + to_str(eptr));
+      return pos->second;
+    }
+    ASSERT(cache.active[closure->fn] < cache.limit,
+           "Applications of one function nest too deeply to typecheck: " +
+               to_str(eptr));
+    cache.bodies[key] = nullptr;
+    cache.active[closure->fn]++;
+    Type *body_type = typecheck(closure->fn->expr, closure_tenv, cache);
+    cache.active[closure->fn]--;
+    cache.bodies[key] = body_type;
+    return body_type;
   }
-  return str;
+  ALARM("Unsupported expr in Nameless::typecheck: " + eptr->expr_name());
+}
+
+Type *typecheck(Expr *eptr, TEnv tenv) {
+  TypeCache cache(size(eptr));
+  return typecheck(eptr, tenv, cache);
+}
+
+// Writes the text returned by to_str, in time linear in the size of the
+// tree, without recursion.
+void print(std::ostream &os, Expr *root) {
+  // each item is either a node or a literal to be written
+  std::vector<std::pair<Expr *, const char *>> work = {{root, nullptr}};
+  while (!work.empty()) {
+    std::pair<Expr *, const char *> item = work.back();
+    work.pop_back();
+    if (item.second != nullptr) {
+      os << item.second;
+      continue;
+    }
+    Expr *eptr = item.first;
+    if (isinstanceof<Cst>(eptr)) {
+      Cst *cst = static_cast<Cst *>(eptr);
+      os << cst->val;
+    } else if (isinstanceof<Add>(eptr)) {
+      Add *add = static_cast<Add *>(eptr);
+      work.push_back({add->e2, nullptr});
+      work.push_back({nullptr, " + "});
+      work.push_back({add->e1, nullptr});
+    } else if (isinstanceof<Mul>(eptr)) {
+      Mul *mul = static_cast<Mul *>(eptr);
+      work.push_back({mul->e2, nullptr});
+      work.push_back({nullptr, " * "});
+      work.push_back({mul->e1, nullptr});
+    } else if (isinstanceof<Var>(eptr)) {
+      Var *var = static_cast<Var *>(eptr);
+      os << "Var(" << var->index << ")";
+    } else if (isinstanceof<Let>(eptr)) {
+      Let *let = static_cast<Let *>(eptr);
+      os << "let ";
+      work.push_back({let->e2, nullptr});
+      work.push_back({nullptr, " in "});
+      work.push_back({let->e1, nullptr});
+    } else if (isinstanceof<Fn>(eptr)) {
+      Fn *fn = static_cast<Fn *>(eptr);
+      os << "Fn{";
+      work.push_back({nullptr, "}"});
+      work.push_back({fn->expr, nullptr});
+    } else if (isinstanceof<App>(eptr)) {
+      App *app = static_cast<App *>(eptr);
+      work.push_back({nullptr, ")"});
+      for (size_t i = app->arguments.size(); i-- > 0;) {
+        work.push_back({app->arguments[i], nullptr});
+        if (i != 0) {
+          work.push_back({nullptr, ", "});
+        }
+      }
+      work.push_back({nullptr, "("});
+      work.push_back({app->expr, nullptr});
+    } else {
+      ALARM("Unsupported expr in Nameless::print: " + eptr->expr_name());
+    }
+  }
+}
+
+std::string to_str(Expr *eptr) {
+  std::ostringstream oss;
+  print(oss, eptr);
+  return oss.str();
 }
 
 } // namespace Nameless
@@ -501,10 +1215,13 @@ typedef std::list<Instr *> InstrPtrs;
 
 int eval(InstrPtrs instrs, Stack stack) {
   for (Instr *instrPtr : instrs) {
+    PROFILE_DEPTH("Instruction", "stack", stack.size());
     if (isinstanceof<Cst>(instrPtr)) {
+      PROFILE_NODE("Instruction", "Cst", instrPtr);
       Instruction::Cst *cst = static_cast<Instruction::Cst *>(instrPtr);
       stack.insert(stack.begin(), cst->val);
     } else if (isinstanceof<Add>(instrPtr)) {
+      PROFILE_NODE("Instruction", "Add", instrPtr);
       ASSERT(stack.size() >= 2,
              "Inadequate values in stack for Add instruction");
       int val1 = stack.front();
@@ -513,6 +1230,7 @@ int eval(InstrPtrs instrs, Stack stack) {
       stack.pop_front();
       stack.insert(stack.begin(), val1 + val2);
     } else if (isinstanceof<Mul>(instrPtr)) {
+      PROFILE_NODE("Instruction", "Mul", instrPtr);
       ASSERT(stack.size() >= 2,
              "Inadequate values in stack for Mul instruction");
       int val1 = stack.front();
@@ -521,6 +1239,7 @@ int eval(InstrPtrs instrs, Stack stack) {
       stack.pop_front();
       stack.insert(stack.begin(), val1 * val2);
     } else if (isinstanceof<Var>(instrPtr)) {
+      PROFILE_NODE("Instruction", "Var", instrPtr);
       Var *varptr = static_cast<Var *>(instrPtr);
       std::list<int>::iterator listi;
       int count = 0;
@@ -532,8 +1251,10 @@ int eval(InstrPtrs instrs, Stack stack) {
         }
       }
     } else if (isinstanceof<Pop>(instrPtr)) {
+      PROFILE_NODE("Instruction", "Pop", instrPtr);
       stack.pop_front();
     } else if (isinstanceof<Swap>(instrPtr)) {
+      PROFILE_NODE("Instruction", "Swap", instrPtr);
       int val1 = stack.front();
       stack.pop_front();
       int val2 = stack.front();
@@ -544,38 +1265,552 @@ int eval(InstrPtrs instrs, Stack stack) {
       ALARM("Unsupported expr in Instr::to_str: " + instrPtr->expr_name());
     }
   }
+  PROFILE_DEPTH("Instruction", "stack", stack.size());
   ASSERT(stack.size() == 1,
          "Incorrect number of elements in stack, and size equals " +
              std::to_string(stack.size()));
   return *(stack.begin());
 }
 
-std::string to_str(InstrPtrs instrs) {
-  std::string str = "";
+// Checks that instrs, run on a stack of `depth` values, never read or pop
+// below the bottom of the stack and leave exactly one value. Returns the
+// maximum depth reached, which eval_verified preallocates.
+size_t verify(const InstrPtrs &instrs, size_t depth = 0) {
+  size_t max_depth = depth;
+  for (Instr *instrPtr : instrs) {
+    if (isinstanceof<Cst>(instrPtr)) {
+      depth++;
+    } else if (isinstanceof<Add>(instrPtr) || isinstanceof<Mul>(instrPtr)) {
+      ASSERT(depth >= 2, "Inadequate values in stack for " +
+                             instrPtr->expr_name() + " instruction");
+      depth--;
+    } else if (isinstanceof<Var>(instrPtr)) {
+      Var *varptr = static_cast<Var *>(instrPtr);
+      ASSERT(varptr->index >= 0 && (size_t)varptr->index < depth,
+             "Var" + std::to_string(varptr->index) +
+                 " is out of the stack's scope (" + std::to_string(depth) +
+                 ")");
+      depth++;
+    } else if (isinstanceof<Pop>(instrPtr)) {
+      ASSERT(depth >= 1, "Inadequate values in stack for Pop instruction");
+      depth--;
+    } else if (isinstanceof<Swap>(instrPtr)) {
+      ASSERT(depth >= 2, "Inadequate values in stack for Swap instruction");
+    } else {
+      ALARM("Unsupported instr in Instr::verify: " + instrPtr->expr_name());
+    }
+    max_depth = std::max(max_depth, depth);
+  }
+  ASSERT(depth == 1, "Incorrect number of elements in stack, and size equals " +
+                         std::to_string(depth));
+  return max_depth;
+}
+
+// eval for programs accepted by verify, which returned `max_depth`. The
+// stack is a preallocated array and no instruction is checked.
+int eval_verified(const InstrPtrs &instrs, Stack stack, size_t max_depth) {
+  std::vector<int> slots(max_depth);
+  // slots[top - 1] is the top of the stack
+  size_t top = 0;
+  for (auto li = stack.rbegin(); li != stack.rend(); ++li) {
+    slots[top++] = *li;
+  }
+  for (Instr *instrPtr : instrs) {
+    if (isinstanceof<Cst>(instrPtr)) {
+      slots[top++] = static_cast<Cst *>(instrPtr)->val;
+    } else if (isinstanceof<Add>(instrPtr)) {
+      top--;
+      slots[top - 1] += slots[top];
+    } else if (isinstanceof<Mul>(instrPtr)) {
+      top--;
+      slots[top - 1] *= slots[top];
+    } else if (isinstanceof<Var>(instrPtr)) {
+      int value = slots[top - 1 - static_cast<Var *>(instrPtr)->index];
+      slots[top++] = value;
+    } else if (isinstanceof<Pop>(instrPtr)) {
+      top--;
+    } else {
+      std::swap(slots[top - 1], slots[top - 2]);
+    }
+  }
+  return slots[0];
+}
+
+void print(std::ostream &os, const InstrPtrs &instrs) {
   for (Instr *instr : instrs) {
     if (isinstanceof<Cst>(instr)) {
       Cst *cstptr = static_cast<Cst *>(instr);
-      str += ">| Cst " + std::to_string(cstptr->val) + "\n";
+      os << ">| Cst " << cstptr->val << "\n";
     } else if (isinstanceof<Add>(instr)) {
-      str += ">| Add\n";
+      os << ">| Add\n";
     } else if (isinstanceof<Mul>(instr)) {
-      str += ">| Mul\n";
+      os << ">| Mul\n";
     } else if (isinstanceof<Var>(instr)) {
       Var *varptr = static_cast<Var *>(instr);
-      str += ">| Var" + std::to_string(varptr->index) + "\n";
+      os << ">| Var" << varptr->index << "\n";
     } else if (isinstanceof<Pop>(instr)) {
-      str += ">| Pop\n";
+      os << ">| Pop\n";
     } else if (isinstanceof<Swap>(instr)) {
-      str += ">| Swap\n";
+      os << ">| Swap\n";
     } else {
-      ALARM("Unsupported instr in Instr::to_str: " + instr->expr_name());
+      ALARM("Unsupported instr in Instr::print: " + instr->expr_name());
     }
   }
-  return str;
+}
+
+std::string to_str(InstrPtrs instrs) {
+  std::ostringstream oss;
+  print(oss, instrs);
+  return oss.str();
 }
 
 } // namespace Instruction
 
+#ifdef SC_PROFILE
+namespace Profile {
+
+// One line per executed source node (or instruction), hottest first:
+//   count  interp  kind  id  source
+std::string hot_list(size_t limit = 20, size_t width = 60) {
+  std::vector<std::pair<const void *, NodeStat>> entries(nodes.begin(),
+                                                         nodes.end());
+  std::sort(entries.begin(), entries.end(),
+            [](const auto &a, const auto &b) {
+              return a.second.count > b.second.count;
+            });
+  std::ostringstream oss;
+  for (size_t i = 0; i < entries.size() && i < limit; i++) {
+    const void *node = entries[i].first;
+    const NodeStat &stat = entries[i].second;
+    std::string source;
+    if (std::string(stat.interp) == "Expr") {
+      source =
+          Expr::to_str(static_cast<Expr::Expr *>(const_cast<void *>(node)));
+    } else if (std::string(stat.interp) == "Nameless") {
+      source = Nameless::to_str(
+          static_cast<Nameless::Expr *>(const_cast<void *>(node)));
+    } else {
+      source = Instruction::to_str(
+          {static_cast<Instruction::Instr *>(const_cast<void *>(node))});
+      source = source.substr(0, source.size() - 1);
+    }
+    if (source.size() > width) {
+      source = source.substr(0, width - 3) + "...";
+    }
+    oss << stat.count << "\t" << stat.interp << "\t" << stat.kind << "\t"
+        << node_id(node) << "\t" << source << "\n";
+  }
+  return oss.str();
+}
+
+} // namespace Profile
+#endif
+
+// Binary format for compiled Instruction programs. A serialized program is a
+// fixed header followed by an array of fixed-size codes, so a buffer obtained
+// by mmap can be executed in place without parsing or copying.
+//
+//   Header | Code[count]
+//
+// All fields are stored in host byte order.
+namespace Bytecode {
+
+enum Opcode : uint32_t {
+  OP_CST = 0,
+  OP_ADD = 1,
+  OP_MUL = 2,
+  OP_VAR = 3,
+  OP_POP = 4,
+  OP_SWAP = 5,
+};
+
+const char MAGIC[4] = {'S', 'C', 'B', 'C'};
+const uint32_t VERSION = 1;
+
+struct Header {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  // FNV-1a over the code array
+  uint32_t checksum;
+};
+
+struct Code {
+  uint32_t opcode;
+  int32_t operand;
+};
+
+static_assert(sizeof(Header) == 16, "Bytecode::Header must be 16 bytes");
+static_assert(sizeof(Code) == 8, "Bytecode::Code must be 8 bytes");
+
+uint32_t checksum(const Code *codes, size_t count) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(codes);
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < count * sizeof(Code); i++) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+Code encode(Instruction::Instr *instr) {
+  if (isinstanceof<Instruction::Cst>(instr)) {
+    Instruction::Cst *cst = static_cast<Instruction::Cst *>(instr);
+    return {OP_CST, cst->val};
+  } else if (isinstanceof<Instruction::Add>(instr)) {
+    return {OP_ADD, 0};
+  } else if (isinstanceof<Instruction::Mul>(instr)) {
+    return {OP_MUL, 0};
+  } else if (isinstanceof<Instruction::Var>(instr)) {
+    Instruction::Var *var = static_cast<Instruction::Var *>(instr);
+    return {OP_VAR, var->index};
+  } else if (isinstanceof<Instruction::Pop>(instr)) {
+    return {OP_POP, 0};
+  } else if (isinstanceof<Instruction::Swap>(instr)) {
+    return {OP_SWAP, 0};
+  }
+  ALARM("Unsupported instr in Bytecode::encode: " + instr->expr_name());
+}
+
+std::string serialize(const Instruction::InstrPtrs &instrs) {
+  std::vector<Code> codes;
+  codes.reserve(instrs.size());
+  for (Instruction::Instr *instr : instrs) {
+    codes.push_back(encode(instr));
+  }
+  Header header;
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.count = codes.size();
+  header.checksum = checksum(codes.data(), codes.size());
+  std::string bytes(sizeof(Header) + codes.size() * sizeof(Code), '\0');
+  std::memcpy(&bytes[0], &header, sizeof(Header));
+  if (!codes.empty()) {
+    std::memcpy(&bytes[sizeof(Header)], codes.data(),
+                codes.size() * sizeof(Code));
+  }
+  return bytes;
+}
+
+// A view over a serialized program. It does not own the underlying buffer,
+// which must outlive it.
+class Program {
+public:
+  Program(const Code *codes, size_t count) : codes(codes), count(count) {}
+  const Code *codes;
+  size_t count;
+};
+
+// `data` must be aligned to at least 4 bytes, which holds for mmap'd files
+// and for buffers returned by operator new.
+Program load(const void *data, size_t size, bool verify_checksum = true) {
+  ASSERT(size >= sizeof(Header), "Bytecode buffer is smaller than its header");
+  const Header *header = static_cast<const Header *>(data);
+  ASSERT(std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0,
+         "Bytecode buffer has a bad magic number");
+  ASSERT(header->version == VERSION,
+         "Unsupported bytecode version " + std::to_string(header->version));
+  ASSERT(size == sizeof(Header) + header->count * sizeof(Code),
+         "Bytecode buffer size does not match its instruction count");
+  const Code *codes = reinterpret_cast<const Code *>(header + 1);
+  if (verify_checksum) {
+    ASSERT(checksum(codes, header->count) == header->checksum,
+           "Bytecode checksum mismatch");
+  }
+  return Program(codes, header->count);
+}
+
+Instruction::InstrPtrs decode(const Program &program) {
+  Instruction::InstrPtrs instrs;
+  for (size_t i = 0; i < program.count; i++) {
+    const Code &code = program.codes[i];
+    switch (code.opcode) {
+    case OP_CST:
+      instrs.push_back(new Instruction::Cst(code.operand));
+      break;
+    case OP_ADD:
+      instrs.push_back(new Instruction::Add());
+      break;
+    case OP_MUL:
+      instrs.push_back(new Instruction::Mul());
+      break;
+    case OP_VAR:
+      instrs.push_back(new Instruction::Var(code.operand));
+      break;
+    case OP_POP:
+      instrs.push_back(new Instruction::Pop());
+      break;
+    case OP_SWAP:
+      instrs.push_back(new Instruction::Swap());
+      break;
+    default:
+      ALARM("Unsupported opcode in Bytecode::decode: " +
+            std::to_string(code.opcode));
+    }
+  }
+  return instrs;
+}
+
+// Same semantics as Instruction::eval, executed directly on the codes.
+// The top of the stack is the back of the vector.
+int eval(const Program &program, Instruction::Stack stack) {
+  std::vector<int> vstack(stack.rbegin(), stack.rend());
+  for (size_t i = 0; i < program.count; i++) {
+    const Code &code = program.codes[i];
+    switch (code.opcode) {
+    case OP_CST:
+      vstack.push_back(code.operand);
+      break;
+    case OP_ADD: {
+      ASSERT(vstack.size() >= 2,
+             "Inadequate values in stack for Add instruction");
+      int val1 = vstack.back();
+      vstack.pop_back();
+      vstack.back() += val1;
+      break;
+    }
+    case OP_MUL: {
+      ASSERT(vstack.size() >= 2,
+             "Inadequate values in stack for Mul instruction");
+      int val1 = vstack.back();
+      vstack.pop_back();
+      vstack.back() *= val1;
+      break;
+    }
+    case OP_VAR:
+      ASSERT(code.operand >= 0 && (size_t)code.operand < vstack.size(),
+             "Var " + std::to_string(code.operand) +
+                 " is out of the stack's scope");
+      vstack.push_back(vstack[vstack.size() - 1 - code.operand]);
+      break;
+    case OP_POP:
+      ASSERT(vstack.size() >= 1,
+             "Inadequate values in stack for Pop instruction");
+      vstack.pop_back();
+      break;
+    case OP_SWAP:
+      ASSERT(vstack.size() >= 2,
+             "Inadequate values in stack for Swap instruction");
+      std::swap(vstack[vstack.size() - 1], vstack[vstack.size() - 2]);
+      break;
+    default:
+      ALARM("Unsupported opcode in Bytecode::eval: " +
+            std::to_string(code.opcode));
+    }
+  }
+  ASSERT(vstack.size() == 1,
+         "Incorrect number of elements in stack, and size equals " +
+             std::to_string(vstack.size()));
+  return vstack.back();
+}
+
+void write(const std::string &path, const std::string &bytes) {
+  FILE *file = fopen(path.c_str(), "wb");
+  ASSERT(file != nullptr, "Cannot open " + path + " for writing");
+  size_t written = fwrite(bytes.data(), 1, bytes.size(), file);
+  fclose(file);
+  ASSERT(written == bytes.size(), "Cannot write bytecode to " + path);
+}
+
+// Read-only mapping of a bytecode file, unmapped on destruction.
+class MappedFile {
+public:
+  MappedFile(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    ASSERT(fd >= 0, "Cannot open " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      ALARM("Cannot stat " + path);
+    }
+    size = st.st_size;
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    ASSERT(data != MAP_FAILED, "Cannot mmap " + path);
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { munmap(data, size); }
+  Program program(bool verify_checksum = true) const {
+    return load(data, size, verify_checksum);
+  }
+  void *data;
+  size_t size;
+};
+
+} // namespace Bytecode
+
+// Struct-of-arrays form of Nameless::Expr. Nodes live in parallel arrays
+// and refer to each other by 32-bit index instead of by pointer, and the
+// argument lists of every App share one side array.
+namespace Flat {
+
+enum Kind : uint8_t { CST, ADD, MUL, VAR, LET, FN, APP };
+
+class Pool {
+public:
+  // appends a node and returns its index
+  uint32_t add(Kind k, int32_t op, uint32_t e1, uint32_t e2) {
+    ASSERT(kind.size() < UINT32_MAX, "Flat::Pool is full");
+    kind.push_back(k);
+    operand.push_back(op);
+    first.push_back(e1);
+    second.push_back(e2);
+    return kind.size() - 1;
+  }
+  size_t size() const { return kind.size(); }
+  size_t bytes() const {
+    return kind.size() * (sizeof(uint8_t) + sizeof(int32_t) +
+                          2 * sizeof(uint32_t)) +
+           arguments.size() * sizeof(uint32_t);
+  }
+
+  std::vector<uint8_t> kind;
+  // value of Cst, index of Var, arity of Fn, argument count of App
+  std::vector<int32_t> operand;
+  // e1 of Add, Mul and Let, body of Fn, function of App
+  std::vector<uint32_t> first;
+  // e2 of Add, Mul and Let, offset of an App's arguments in `arguments`
+  std::vector<uint32_t> second;
+  std::vector<uint32_t> arguments;
+};
+
+// Appends eptr to the pool, children first, and returns its index.
+uint32_t fromNameless(Pool &pool, Nameless::Expr *eptr) {
+  if (isinstanceof<Nameless::Cst>(eptr)) {
+    Nameless::Cst *cst = static_cast<Nameless::Cst *>(eptr);
+    return pool.add(CST, cst->val, 0, 0);
+  } else if (isinstanceof<Nameless::Add>(eptr)) {
+    Nameless::Add *add = static_cast<Nameless::Add *>(eptr);
+    uint32_t e1 = fromNameless(pool, add->e1);
+    uint32_t e2 = fromNameless(pool, add->e2);
+    return pool.add(ADD, 0, e1, e2);
+  } else if (isinstanceof<Nameless::Mul>(eptr)) {
+    Nameless::Mul *mul = static_cast<Nameless::Mul *>(eptr);
+    uint32_t e1 = fromNameless(pool, mul->e1);
+    uint32_t e2 = fromNameless(pool, mul->e2);
+    return pool.add(MUL, 0, e1, e2);
+  } else if (isinstanceof<Nameless::Var>(eptr)) {
+    Nameless::Var *var = static_cast<Nameless::Var *>(eptr);
+    return pool.add(VAR, var->index, 0, 0);
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    uint32_t e1 = fromNameless(pool, let->e1);
+    uint32_t e2 = fromNameless(pool, let->e2);
+    return pool.add(LET, 0, e1, e2);
+  } else if (isinstanceof<Nameless::Fn>(eptr)) {
+    Nameless::Fn *fn = static_cast<Nameless::Fn *>(eptr);
+    uint32_t body = fromNameless(pool, fn->expr);
+    return pool.add(FN, fn->arity, body, 0);
+  } else if (isinstanceof<Nameless::App>(eptr)) {
+    Nameless::App *app = static_cast<Nameless::App *>(eptr);
+    uint32_t fn = fromNameless(pool, app->expr);
+    std::vector<uint32_t> arguments;
+    for (Nameless::Expr *argument : app->arguments) {
+      arguments.push_back(fromNameless(pool, argument));
+    }
+    // the arguments' own argument lists are complete, so this one is
+    // contiguous
+    uint32_t offset = pool.arguments.size();
+    pool.arguments.insert(pool.arguments.end(), arguments.begin(),
+                          arguments.end());
+    return pool.add(APP, arguments.size(), fn, offset);
+  }
+  ALARM("Unsupported Nameless::Expr in Flat::fromNameless: " +
+        eptr->expr_name());
+}
+
+Nameless::Expr *toNameless(const Pool &pool, uint32_t node) {
+  switch (pool.kind[node]) {
+  case CST:
+    return new Nameless::Cst(pool.operand[node]);
+  case ADD:
+    return new Nameless::Add(toNameless(pool, pool.first[node]),
+                             toNameless(pool, pool.second[node]));
+  case MUL:
+    return new Nameless::Mul(toNameless(pool, pool.first[node]),
+                             toNameless(pool, pool.second[node]));
+  case VAR:
+    return new Nameless::Var(pool.operand[node]);
+  case LET:
+    return new Nameless::Let(toNameless(pool, pool.first[node]),
+                             toNameless(pool, pool.second[node]));
+  case FN:
+    return new Nameless::Fn(toNameless(pool, pool.first[node]),
+                            pool.operand[node]);
+  case APP: {
+    std::vector<Nameless::Expr *> arguments;
+    for (int32_t i = 0; i < pool.operand[node]; i++) {
+      arguments.push_back(
+          toNameless(pool, pool.arguments[pool.second[node] + i]));
+    }
+    return new Nameless::App(toNameless(pool, pool.first[node]),
+                             std::move(arguments));
+  }
+  }
+  ALARM("Unsupported kind in Flat::toNameless: " +
+        std::to_string(pool.kind[node]));
+}
+
+// A closure over a pool node. Values share Nameless's heap and Vint.
+class Vclosure : public Nameless::Value {
+public:
+  Vclosure(Nameless::Env env, uint32_t body) : env(env), body(body) {}
+  Nameless::Env env;
+  uint32_t body;
+};
+
+// Same semantics and checks as Nameless::eval.
+Nameless::Value *eval(const Pool &pool, uint32_t node, Nameless::Env env) {
+  switch (pool.kind[node]) {
+  case CST:
+    return Nameless::heap.make<Nameless::Vint>(pool.operand[node]);
+  case ADD:
+    return Nameless::vadd(eval(pool, pool.first[node], env),
+                          eval(pool, pool.second[node], env));
+  case MUL:
+    return Nameless::vmul(eval(pool, pool.first[node], env),
+                          eval(pool, pool.second[node], env));
+  case VAR: {
+    int32_t index = pool.operand[node];
+    ASSERT(index >= 0 && (size_t)index < env.size(),
+           "var " + std::to_string(index) + "'s index is out of env's scope (" +
+               std::to_string(env.size()) + ")");
+    return env[index];
+  }
+  case LET:
+    env.push_back(eval(pool, pool.first[node], env));
+    return eval(pool, pool.second[node], env);
+  case FN:
+    return Nameless::heap.make<Vclosure>(env, pool.first[node]);
+  case APP: {
+    Nameless::Value *maybe_closure = eval(pool, pool.first[node], env);
+    ASSERT(isinstanceof<Vclosure>(maybe_closure),
+           "Expression for application cannot be evaluated into Vclosure");
+    Vclosure *closure = static_cast<Vclosure *>(maybe_closure);
+    Nameless::Env closure_env = closure->env;
+    for (int32_t i = 0; i < pool.operand[node]; i++) {
+      closure_env.push_back(
+          eval(pool, pool.arguments[pool.second[node] + i], env));
+    }
+    return eval(pool, closure->body, closure_env);
+  }
+  }
+  ALARM("Unsupported kind in Flat::eval: " + std::to_string(pool.kind[node]));
+}
+
+// this eval promises to get a int value, and releases every value allocated
+// during the evaluation before returning
+int eval_final(const Pool &pool, uint32_t node, Nameless::Env env) {
+  Heap<Nameless::Value>::Region region(Nameless::heap);
+  Nameless::Value *value = eval(pool, node, env);
+  ASSERT(isinstanceof<Nameless::Vint>(value),
+         "Value is not of type Vint in function eval_final");
+  return static_cast<Nameless::Vint *>(value)->val;
+}
+
+} // namespace Flat
+
 namespace Compiler {
 
 typedef std::vector<std::string> CEnv;
@@ -623,7 +1858,7 @@ Nameless::Expr *lowerFromExprToNameless(Expr::Expr *eptr, CEnv cenv) {
       cenv.push_back(param);
     }
     Nameless::Expr *body = lowerFromExprToNameless(fn->expr, cenv);
-    return new Nameless::Fn(body);
+    return new Nameless::Fn(body, fn->params.size());
   } else if (isinstanceof<Expr::App>(eptr)) {
     Expr::App *app = static_cast<Expr::App *>(eptr);
     Nameless::Expr *fn = lowerFromExprToNameless(app->fn, cenv);
@@ -720,4 +1955,679 @@ Instruction::InstrPtrs lowerFromNamelessToInstruction(Nameless::Expr *eptr,
         eptr->expr_name());
 }
 
-} // namespace Compiler
\ No newline at end of file
+// lowerFromNamelessToInstruction over the flat form
+Instruction::InstrPtrs lowerFromFlatToInstruction(const Flat::Pool &pool,
+                                                  uint32_t node, AEnv aenv) {
+  switch (pool.kind[node]) {
+  case Flat::CST:
+    return {new Instruction::Cst(pool.operand[node])};
+  case Flat::ADD:
+  case Flat::MUL: {
+    Instruction::InstrPtrs instrPtrs =
+        lowerFromFlatToInstruction(pool, pool.first[node], aenv);
+    aenv.push_front(new Stmp());
+    instrPtrs.splice(instrPtrs.end(), lowerFromFlatToInstruction(
+                                          pool, pool.second[node], aenv));
+    if (pool.kind[node] == Flat::ADD) {
+      instrPtrs.push_back(new Instruction::Add());
+    } else {
+      instrPtrs.push_back(new Instruction::Mul());
+    }
+    return instrPtrs;
+  }
+  case Flat::VAR:
+    return {new Instruction::Var(
+        findIndexofInstructionVar(pool.operand[node], aenv))};
+  case Flat::LET: {
+    Instruction::InstrPtrs instrPtrs =
+        lowerFromFlatToInstruction(pool, pool.first[node], aenv);
+    aenv.push_front(new Slocal());
+    instrPtrs.splice(instrPtrs.end(), lowerFromFlatToInstruction(
+                                          pool, pool.second[node], aenv));
+    instrPtrs.push_back(new Instruction::Swap());
+    instrPtrs.push_back(new Instruction::Pop());
+    return instrPtrs;
+  }
+  }
+  ALARM("Unsupported kind in lowerFromFlatToInstruction: " +
+        std::to_string(pool.kind[node]));
+}
+
+} // namespace Compiler
+
+namespace Optimizer {
+
+// Nameless Var indices are absolute env slots, so moving an expression to a
+// different env depth only requires renumbering the slots bound at or above
+// the depth it was built for.
+// Copies eptr, mapping each slot s to
+//   s                      if s < from
+//   params[s - from]       if from <= s < from + params.size()
+//   s + shift              otherwise
+Nameless::Expr *relocate(Nameless::Expr *eptr, int from,
+                         const std::vector<int> &params, int shift) {
+  if (isinstanceof<Nameless::Cst>(eptr)) {
+    return eptr;
+  } else if (isinstanceof<Nameless::Var>(eptr)) {
+    int index = static_cast<Nameless::Var *>(eptr)->index;
+    if (index < from) {
+      return eptr;
+    } else if (index < from + (int)params.size()) {
+      return new Nameless::Var(params[index - from]);
+    }
+    return new Nameless::Var(index + shift);
+  } else if (isinstanceof<Nameless::Add>(eptr)) {
+    Nameless::Add *add = static_cast<Nameless::Add *>(eptr);
+    return new Nameless::Add(relocate(add->e1, from, params, shift),
+                             relocate(add->e2, from, params, shift));
+  } else if (isinstanceof<Nameless::Mul>(eptr)) {
+    Nameless::Mul *mul = static_cast<Nameless::Mul *>(eptr);
+    return new Nameless::Mul(relocate(mul->e1, from, params, shift),
+                             relocate(mul->e2, from, params, shift));
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    return new Nameless::Let(relocate(let->e1, from, params, shift),
+                             relocate(let->e2, from, params, shift));
+  } else if (isinstanceof<Nameless::Fn>(eptr)) {
+    Nameless::Fn *fn = static_cast<Nameless::Fn *>(eptr);
+    return new Nameless::Fn(relocate(fn->expr, from, params, shift),
+                            fn->arity);
+  } else if (isinstanceof<Nameless::App>(eptr)) {
+    Nameless::App *app = static_cast<Nameless::App *>(eptr);
+    std::vector<Nameless::Expr *> arguments;
+    for (Nameless::Expr *argument : app->arguments) {
+      arguments.push_back(relocate(argument, from, params, shift));
+    }
+    return new Nameless::App(relocate(app->expr, from, params, shift),
+                             std::move(arguments));
+  }
+  ALARM("Unsupported Nameless::Expr in relocate: " + eptr->expr_name());
+}
+
+// Partial evaluation over Nameless::Expr. Every subexpression is evaluated
+// to a PValue: either a value known at specialization time or a residual
+// expression computing it at run time.
+class PValue {
+public:
+  virtual ~PValue() {}
+};
+
+typedef std::vector<PValue *> PEnv;
+
+class Sint : public PValue {
+public:
+  Sint(int val) : val(val) {}
+  int val;
+};
+
+class Sclosure : public PValue {
+public:
+  Sclosure(PEnv env, Nameless::Fn *fn) : env(env), fn(fn) {}
+  PEnv env;
+  Nameless::Fn *fn;
+};
+
+// Var indices in `residual` are env slots of the residual program, which
+// are absolute, so a residual stays valid at any deeper point of its scope.
+class Dynamic : public PValue {
+public:
+  Dynamic(Nameless::Expr *residual) : residual(residual) {}
+  Nameless::Expr *residual;
+};
+
+// bound on nested unfoldings, so that self-application such as
+// `let w = fn(x){x(x)} in w(w)` still terminates
+const int UNFOLD_LIMIT = 64;
+
+// Every unfolding and every rebuilt closure copies the body of a Fn into
+// the residual program. These copies may add up to RESIDUAL_GROWTH times
+// the size of the program, shared by the whole specialization, so that
+// unfoldings that branch stay bounded in time and in residual size.
+const int RESIDUAL_GROWTH = 8;
+
+// Thrown by reify once a closure no longer fits in the budget.
+class OutOfBudget {};
+
+PValue *partialEval(Nameless::Expr *eptr, PEnv penv, int depth, int fuel,
+                    int &budget);
+
+// `depth` is the size of the residual env at the point of use.
+Nameless::Expr *reify(PValue *pval, int depth, int fuel, int &budget) {
+  if (isinstanceof<Sint>(pval)) {
+    return new Nameless::Cst(static_cast<Sint *>(pval)->val);
+  } else if (isinstanceof<Dynamic>(pval)) {
+    return static_cast<Dynamic *>(pval)->residual;
+  } else if (isinstanceof<Sclosure>(pval)) {
+    Sclosure *closure = static_cast<Sclosure *>(pval);
+    int cost = size(closure->fn->expr);
+    if (cost > budget) {
+      throw OutOfBudget();
+    }
+    budget -= cost;
+    PEnv body_env = closure->env;
+    for (int i = 0; i < closure->fn->arity; i++) {
+      body_env.push_back(new Dynamic(new Nameless::Var(depth + i)));
+    }
+    int body_depth = depth + closure->fn->arity;
+    Nameless::Expr *body = reify(
+        partialEval(closure->fn->expr, body_env, body_depth, fuel, budget),
+        body_depth, fuel, budget);
+    return new Nameless::Fn(body, closure->fn->arity);
+  }
+  ALARM("Unsupported PValue in reify");
+}
+
+bool isDynamicVar(PValue *pval) {
+  return isinstanceof<Dynamic>(pval) &&
+         isinstanceof<Nameless::Var>(static_cast<Dynamic *>(pval)->residual);
+}
+
+PValue *partialEval(Nameless::Expr *eptr, PEnv penv, int depth, int fuel,
+                    int &budget) {
+  if (isinstanceof<Nameless::Cst>(eptr)) {
+    Nameless::Cst *cst = static_cast<Nameless::Cst *>(eptr);
+    return new Sint(cst->val);
+  } else if (isinstanceof<Nameless::Add>(eptr) ||
+             isinstanceof<Nameless::Mul>(eptr)) {
+    bool is_add = isinstanceof<Nameless::Add>(eptr);
+    Nameless::Expr *e1 = is_add ? static_cast<Nameless::Add *>(eptr)->e1
+                                : static_cast<Nameless::Mul *>(eptr)->e1;
+    Nameless::Expr *e2 = is_add ? static_cast<Nameless::Add *>(eptr)->e2
+                                : static_cast<Nameless::Mul *>(eptr)->e2;
+    PValue *v1 = partialEval(e1, penv, depth, fuel, budget);
+    PValue *v2 = partialEval(e2, penv, depth, fuel, budget);
+    if (isinstanceof<Sint>(v1) && isinstanceof<Sint>(v2)) {
+      int val1 = static_cast<Sint *>(v1)->val;
+      int val2 = static_cast<Sint *>(v2)->val;
+      return new Sint(is_add ? val1 + val2 : val1 * val2);
+    }
+    // closures are reified too, so a type error still happens at run time
+    Nameless::Expr *r1 = reify(v1, depth, fuel, budget);
+    Nameless::Expr *r2 = reify(v2, depth, fuel, budget);
+    if (is_add) {
+      return new Dynamic(new Nameless::Add(r1, r2));
+    }
+    return new Dynamic(new Nameless::Mul(r1, r2));
+  } else if (isinstanceof<Nameless::Var>(eptr)) {
+    Nameless::Var *var = static_cast<Nameless::Var *>(eptr);
+    ASSERT(var->index >= 0 && (size_t)var->index < penv.size(),
+           "var " + std::to_string(var->index) +
+               "'s index is out of penv's scope (" +
+               std::to_string(penv.size()) + ")");
+    return penv[var->index];
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    PValue *v1 = partialEval(let->e1, penv, depth, fuel, budget);
+    // known values and aliases of run-time slots need no binding
+    if (!isinstanceof<Dynamic>(v1) || isDynamicVar(v1)) {
+      penv.push_back(v1);
+      return partialEval(let->e2, penv, depth, fuel, budget);
+    }
+    penv.push_back(new Dynamic(new Nameless::Var(depth)));
+    Nameless::Expr *body =
+        reify(partialEval(let->e2, penv, depth + 1, fuel, budget), depth + 1,
+              fuel, budget);
+    return new Dynamic(
+        new Nameless::Let(static_cast<Dynamic *>(v1)->residual, body));
+  } else if (isinstanceof<Nameless::Fn>(eptr)) {
+    Nameless::Fn *fn = static_cast<Nameless::Fn *>(eptr);
+    return new Sclosure(penv, fn);
+  } else if (isinstanceof<Nameless::App>(eptr)) {
+    Nameless::App *app = static_cast<Nameless::App *>(eptr);
+    PValue *fn_val = partialEval(app->expr, penv, depth, fuel, budget);
+    std::vector<PValue *> arg_vals;
+    for (Nameless::Expr *argument : app->arguments) {
+      arg_vals.push_back(partialEval(argument, penv, depth, fuel, budget));
+    }
+    // reify rebuilds a closure for its declared arity, and eval does not
+    // check arity, so a mismatched call has no faithful residual
+    ASSERT(!isinstanceof<Sclosure>(fn_val) ||
+               static_cast<Sclosure *>(fn_val)->fn->arity ==
+                   (int)arg_vals.size(),
+           "arguments' number does not equal to parameters' number: " +
+               Nameless::to_str(eptr));
+    if (isinstanceof<Sclosure>(fn_val) && fuel > 0 &&
+        size(static_cast<Sclosure *>(fn_val)->fn->expr) <= budget) {
+      // unfold the call; run-time arguments are let-bound so that they
+      // are computed once
+      Sclosure *closure = static_cast<Sclosure *>(fn_val);
+      budget -= size(closure->fn->expr);
+      PEnv body_env = closure->env;
+      std::vector<Nameless::Expr *> bindings;
+      for (PValue *arg_val : arg_vals) {
+        if (isinstanceof<Dynamic>(arg_val) && !isDynamicVar(arg_val)) {
+          // the residual was built at `depth`, and is bound after the
+          // previous arguments
+          bindings.push_back(relocate(static_cast<Dynamic *>(arg_val)->residual,
+                                      depth, {}, bindings.size()));
+          int slot = depth + bindings.size() - 1;
+          arg_val = new Dynamic(new Nameless::Var(slot));
+        }
+        body_env.push_back(arg_val);
+      }
+      int body_depth = depth + bindings.size();
+      PValue *result = partialEval(closure->fn->expr, body_env, body_depth,
+                                   fuel - 1, budget);
+      if (bindings.empty()) {
+        return result;
+      }
+      Nameless::Expr *residual = reify(result, body_depth, fuel - 1, budget);
+      for (size_t i = bindings.size(); i-- > 0;) {
+        residual = new Nameless::Let(bindings[i], residual);
+      }
+      return new Dynamic(residual);
+    }
+    std::vector<Nameless::Expr *> arguments;
+    for (PValue *arg_val : arg_vals) {
+      arguments.push_back(reify(arg_val, depth, fuel, budget));
+    }
+    return new Dynamic(new Nameless::App(reify(fn_val, depth, fuel, budget),
+                                         std::move(arguments)));
+  }
+  ALARM("Unsupported Nameless::Expr in partialEval: " + eptr->expr_name());
+}
+
+// Specializes `eptr`, which runs in an env of `env_size` slots, for the
+// slots fixed in `statics` (slot -> constant). The residual program runs in
+// an env holding only the remaining slots, in their original order, and can
+// be passed straight to Compiler::lowerFromNamelessToInstruction once its
+// closures are unfolded. Calls of a known closure with the wrong number of
+// arguments are rejected, and the residual assumes every other closure is
+// called with its own arity too. Unfolding stops once the budget of
+// RESIDUAL_GROWTH is spent, and when a closure still has to be rebuilt
+// after that, the program is returned unspecialized, with the fixed slots
+// let-bound in front of it.
+Nameless::Expr *specialize(Nameless::Expr *eptr,
+                           const std::unordered_map<int, int> &statics,
+                           int env_size) {
+  PEnv penv;
+  std::vector<Nameless::Expr *> slots;
+  int depth = 0;
+  for (int slot = 0; slot < env_size; slot++) {
+    auto pos = statics.find(slot);
+    if (pos != statics.end()) {
+      penv.push_back(new Sint(pos->second));
+      slots.push_back(new Nameless::Cst(pos->second));
+    } else {
+      slots.push_back(new Nameless::Var(depth));
+      penv.push_back(new Dynamic(new Nameless::Var(depth++)));
+    }
+  }
+  int budget = RESIDUAL_GROWTH * size(eptr);
+  try {
+    return reify(partialEval(eptr, penv, depth, UNFOLD_LIMIT, budget), depth,
+                 UNFOLD_LIMIT, budget);
+  } catch (const OutOfBudget &) {
+    // rebuild the original env above the residual one
+    Nameless::Expr *program = relocate(eptr, 0, {}, depth);
+    for (size_t i = slots.size(); i-- > 0;) {
+      program = new Nameless::Let(slots[i], program);
+    }
+    return program;
+  }
+}
+
+// Inlining of let-bound closures.
+
+// Number of occurrences of Var(slot) in eptr, and how many of them are
+// the function of an application with `arity` arguments.
+void countUses(Nameless::Expr *eptr, int slot, int arity, int &uses,
+               int &calls) {
+  if (isinstanceof<Nameless::Var>(eptr)) {
+    if (static_cast<Nameless::Var *>(eptr)->index == slot) {
+      uses++;
+    }
+  } else if (isinstanceof<Nameless::Add>(eptr)) {
+    Nameless::Add *add = static_cast<Nameless::Add *>(eptr);
+    countUses(add->e1, slot, arity, uses, calls);
+    countUses(add->e2, slot, arity, uses, calls);
+  } else if (isinstanceof<Nameless::Mul>(eptr)) {
+    Nameless::Mul *mul = static_cast<Nameless::Mul *>(eptr);
+    countUses(mul->e1, slot, arity, uses, calls);
+    countUses(mul->e2, slot, arity, uses, calls);
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    countUses(let->e1, slot, arity, uses, calls);
+    countUses(let->e2, slot, arity, uses, calls);
+  } else if (isinstanceof<Nameless::Fn>(eptr)) {
+    countUses(static_cast<Nameless::Fn *>(eptr)->expr, slot, arity, uses,
+              calls);
+  } else if (isinstanceof<Nameless::App>(eptr)) {
+    Nameless::App *app = static_cast<Nameless::App *>(eptr);
+    if (isinstanceof<Nameless::Var>(app->expr) &&
+        static_cast<Nameless::Var *>(app->expr)->index == slot &&
+        (int)app->arguments.size() == arity) {
+      calls++;
+    }
+    countUses(app->expr, slot, arity, uses, calls);
+    for (Nameless::Expr *argument : app->arguments) {
+      countUses(argument, slot, arity, uses, calls);
+    }
+  }
+}
+
+// Replaces every call `Var(slot)(args)` in eptr, which sits at env depth
+// `depth`, by the body of `fn`. The closure was created at depth `slot`.
+// Arguments that are not plain slots are let-bound in front of the body.
+Nameless::Expr *inlineCalls(Nameless::Expr *eptr, int depth, int slot,
+                            Nameless::Fn *fn) {
+  if (isinstanceof<Nameless::Cst>(eptr) || isinstanceof<Nameless::Var>(eptr)) {
+    return eptr;
+  } else if (isinstanceof<Nameless::Add>(eptr)) {
+    Nameless::Add *add = static_cast<Nameless::Add *>(eptr);
+    return new Nameless::Add(inlineCalls(add->e1, depth, slot, fn),
+                             inlineCalls(add->e2, depth, slot, fn));
+  } else if (isinstanceof<Nameless::Mul>(eptr)) {
+    Nameless::Mul *mul = static_cast<Nameless::Mul *>(eptr);
+    return new Nameless::Mul(inlineCalls(mul->e1, depth, slot, fn),
+                             inlineCalls(mul->e2, depth, slot, fn));
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    return new Nameless::Let(inlineCalls(let->e1, depth, slot, fn),
+                             inlineCalls(let->e2, depth + 1, slot, fn));
+  } else if (isinstanceof<Nameless::Fn>(eptr)) {
+    Nameless::Fn *inner = static_cast<Nameless::Fn *>(eptr);
+    return new Nameless::Fn(
+        inlineCalls(inner->expr, depth + inner->arity, slot, fn),
+        inner->arity);
+  } else if (isinstanceof<Nameless::App>(eptr)) {
+    Nameless::App *app = static_cast<Nameless::App *>(eptr);
+    std::vector<Nameless::Expr *> arguments;
+    for (Nameless::Expr *argument : app->arguments) {
+      arguments.push_back(inlineCalls(argument, depth, slot, fn));
+    }
+    if (!isinstanceof<Nameless::Var>(app->expr) ||
+        static_cast<Nameless::Var *>(app->expr)->index != slot) {
+      return new Nameless::App(inlineCalls(app->expr, depth, slot, fn),
+                               std::move(arguments));
+    }
+    std::vector<Nameless::Expr *> bindings;
+    std::vector<int> params;
+    for (Nameless::Expr *argument : arguments) {
+      if (isinstanceof<Nameless::Var>(argument)) {
+        params.push_back(static_cast<Nameless::Var *>(argument)->index);
+      } else {
+        params.push_back(depth + bindings.size());
+        bindings.push_back(relocate(argument, depth, {}, bindings.size()));
+      }
+    }
+    // the body's own bindings start at slot + arity, and now start after
+    // the argument bindings
+    int shift = depth + bindings.size() - (slot + fn->arity);
+    Nameless::Expr *body = relocate(fn->expr, slot, params, shift);
+    for (size_t i = bindings.size(); i-- > 0;) {
+      body = new Nameless::Let(bindings[i], body);
+    }
+    return body;
+  }
+  ALARM("Unsupported Nameless::Expr in inlineCalls: " + eptr->expr_name());
+}
+
+// default bound on the number of nodes a binding may add by being inlined
+const int INLINE_BUDGET = 64;
+
+// Beta-reduces applications of let-bound closures whose binding is only
+// ever called with the right number of arguments, as long as the copies of
+// the body stay within `budget` nodes. Bindings left without uses are
+// removed. `depth` is the size of the env eptr runs in.
+Nameless::Expr *inlineClosures(Nameless::Expr *eptr, int depth,
+                               int budget = INLINE_BUDGET) {
+  if (isinstanceof<Nameless::Cst>(eptr) || isinstanceof<Nameless::Var>(eptr)) {
+    return eptr;
+  } else if (isinstanceof<Nameless::Add>(eptr)) {
+    Nameless::Add *add = static_cast<Nameless::Add *>(eptr);
+    return new Nameless::Add(inlineClosures(add->e1, depth, budget),
+                             inlineClosures(add->e2, depth, budget));
+  } else if (isinstanceof<Nameless::Mul>(eptr)) {
+    Nameless::Mul *mul = static_cast<Nameless::Mul *>(eptr);
+    return new Nameless::Mul(inlineClosures(mul->e1, depth, budget),
+                             inlineClosures(mul->e2, depth, budget));
+  } else if (isinstanceof<Nameless::Fn>(eptr)) {
+    Nameless::Fn *fn = static_cast<Nameless::Fn *>(eptr);
+    return new Nameless::Fn(
+        inlineClosures(fn->expr, depth + fn->arity, budget), fn->arity);
+  } else if (isinstanceof<Nameless::App>(eptr)) {
+    Nameless::App *app = static_cast<Nameless::App *>(eptr);
+    std::vector<Nameless::Expr *> arguments;
+    for (Nameless::Expr *argument : app->arguments) {
+      arguments.push_back(inlineClosures(argument, depth, budget));
+    }
+    return new Nameless::App(inlineClosures(app->expr, depth, budget),
+                             std::move(arguments));
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    Nameless::Expr *e1 = inlineClosures(let->e1, depth, budget);
+    Nameless::Expr *e2 = inlineClosures(let->e2, depth + 1, budget);
+    if (!isinstanceof<Nameless::Fn>(e1)) {
+      return new Nameless::Let(e1, e2);
+    }
+    Nameless::Fn *fn = static_cast<Nameless::Fn *>(e1);
+    int uses = 0;
+    int calls = 0;
+    countUses(e2, depth, fn->arity, uses, calls);
+    if (uses != calls || (long)size(fn->expr) * calls > budget) {
+      return new Nameless::Let(e1, e2);
+    }
+    if (calls > 0) {
+      e2 = inlineCalls(e2, depth + 1, depth, fn);
+    }
+    // drop the binding, which is now unused
+    return relocate(e2, depth + 1, {}, -1);
+  }
+  ALARM("Unsupported Nameless::Expr in inlineClosures: " + eptr->expr_name());
+}
+
+// Dead-binding elimination.
+
+bool isPure(Nameless::Expr *eptr, std::vector<bool> &ints);
+
+// Whether eptr always evaluates to an int. ints[slot] tells whether a slot
+// is known to hold one.
+bool isInt(Nameless::Expr *eptr, std::vector<bool> &ints) {
+  if (isinstanceof<Nameless::Cst>(eptr)) {
+    return true;
+  } else if (isinstanceof<Nameless::Var>(eptr)) {
+    int index = static_cast<Nameless::Var *>(eptr)->index;
+    return index >= 0 && (size_t)index < ints.size() && ints[index];
+  } else if (isinstanceof<Nameless::Add>(eptr)) {
+    Nameless::Add *add = static_cast<Nameless::Add *>(eptr);
+    return isInt(add->e1, ints) && isInt(add->e2, ints);
+  } else if (isinstanceof<Nameless::Mul>(eptr)) {
+    Nameless::Mul *mul = static_cast<Nameless::Mul *>(eptr);
+    return isInt(mul->e1, ints) && isInt(mul->e2, ints);
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    if (!isPure(let->e1, ints)) {
+      return false;
+    }
+    ints.push_back(isInt(let->e1, ints));
+    bool result = isInt(let->e2, ints);
+    ints.pop_back();
+    return result;
+  }
+  return false;
+}
+
+// Whether evaluating eptr can be skipped without changing the result.
+// Applications may diverge, so they are kept. Add and Mul fail at run time
+// on closure operands, so they are only pure on operands known to be ints.
+bool isPure(Nameless::Expr *eptr, std::vector<bool> &ints) {
+  if (isinstanceof<Nameless::Add>(eptr) || isinstanceof<Nameless::Mul>(eptr)) {
+    return isInt(eptr, ints);
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    if (!isPure(let->e1, ints)) {
+      return false;
+    }
+    ints.push_back(isInt(let->e1, ints));
+    bool result = isPure(let->e2, ints);
+    ints.pop_back();
+    return result;
+  }
+  return !isinstanceof<Nameless::App>(eptr);
+}
+
+// Usage analysis: the Let binding each slot (nullptr for parameters and
+// free slots) and the number of reads of each Let. markDead also tracks
+// which slots are known to hold ints.
+class Usage {
+public:
+  std::vector<Nameless::Let *> binders;
+  std::vector<bool> ints;
+  std::unordered_map<Nameless::Let *, int> uses;
+  std::unordered_set<Nameless::Let *> dead;
+};
+
+// Adds `delta` to the use count of every binding read in eptr.
+void countReads(Nameless::Expr *eptr, Usage &usage, int delta) {
+  if (isinstanceof<Nameless::Var>(eptr)) {
+    int index = static_cast<Nameless::Var *>(eptr)->index;
+    ASSERT(index >= 0 && (size_t)index < usage.binders.size(),
+           "var " + std::to_string(index) + "'s index is out of env's scope (" +
+               std::to_string(usage.binders.size()) + ")");
+    Nameless::Let *binder = usage.binders[index];
+    if (binder != nullptr) {
+      usage.uses[binder] += delta;
+    }
+  } else if (isinstanceof<Nameless::Add>(eptr)) {
+    Nameless::Add *add = static_cast<Nameless::Add *>(eptr);
+    countReads(add->e1, usage, delta);
+    countReads(add->e2, usage, delta);
+  } else if (isinstanceof<Nameless::Mul>(eptr)) {
+    Nameless::Mul *mul = static_cast<Nameless::Mul *>(eptr);
+    countReads(mul->e1, usage, delta);
+    countReads(mul->e2, usage, delta);
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    countReads(let->e1, usage, delta);
+    usage.binders.push_back(let);
+    countReads(let->e2, usage, delta);
+    usage.binders.pop_back();
+  } else if (isinstanceof<Nameless::Fn>(eptr)) {
+    Nameless::Fn *fn = static_cast<Nameless::Fn *>(eptr);
+    usage.binders.resize(usage.binders.size() + fn->arity, nullptr);
+    countReads(fn->expr, usage, delta);
+    usage.binders.resize(usage.binders.size() - fn->arity);
+  } else if (isinstanceof<Nameless::App>(eptr)) {
+    Nameless::App *app = static_cast<Nameless::App *>(eptr);
+    countReads(app->expr, usage, delta);
+    for (Nameless::Expr *argument : app->arguments) {
+      countReads(argument, usage, delta);
+    }
+  }
+}
+
+// Marks dead bindings, innermost first, so that dropping a binding frees
+// the bindings only its right-hand side reads.
+void markDead(Nameless::Expr *eptr, Usage &usage) {
+  if (isinstanceof<Nameless::Add>(eptr)) {
+    Nameless::Add *add = static_cast<Nameless::Add *>(eptr);
+    markDead(add->e1, usage);
+    markDead(add->e2, usage);
+  } else if (isinstanceof<Nameless::Mul>(eptr)) {
+    Nameless::Mul *mul = static_cast<Nameless::Mul *>(eptr);
+    markDead(mul->e1, usage);
+    markDead(mul->e2, usage);
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    usage.binders.push_back(let);
+    usage.ints.push_back(isInt(let->e1, usage.ints));
+    markDead(let->e2, usage);
+    usage.binders.pop_back();
+    usage.ints.pop_back();
+    if (usage.uses[let] == 0 && isPure(let->e1, usage.ints)) {
+      usage.dead.insert(let);
+      countReads(let->e1, usage, -1);
+    } else {
+      markDead(let->e1, usage);
+    }
+  } else if (isinstanceof<Nameless::Fn>(eptr)) {
+    Nameless::Fn *fn = static_cast<Nameless::Fn *>(eptr);
+    usage.binders.resize(usage.binders.size() + fn->arity, nullptr);
+    usage.ints.resize(usage.ints.size() + fn->arity, false);
+    markDead(fn->expr, usage);
+    usage.binders.resize(usage.binders.size() - fn->arity);
+    usage.ints.resize(usage.ints.size() - fn->arity);
+  } else if (isinstanceof<Nameless::App>(eptr)) {
+    Nameless::App *app = static_cast<Nameless::App *>(eptr);
+    markDead(app->expr, usage);
+    for (Nameless::Expr *argument : app->arguments) {
+      markDead(argument, usage);
+    }
+  }
+}
+
+// Copies eptr without its dead bindings. slots maps each slot of eptr's
+// env to its slot once the dead bindings are gone, -1 for dead ones.
+Nameless::Expr *dropDead(Nameless::Expr *eptr, const Usage &usage,
+                         std::vector<int> &slots, int depth) {
+  if (isinstanceof<Nameless::Cst>(eptr)) {
+    return eptr;
+  } else if (isinstanceof<Nameless::Var>(eptr)) {
+    return new Nameless::Var(slots[static_cast<Nameless::Var *>(eptr)->index]);
+  } else if (isinstanceof<Nameless::Add>(eptr)) {
+    Nameless::Add *add = static_cast<Nameless::Add *>(eptr);
+    return new Nameless::Add(dropDead(add->e1, usage, slots, depth),
+                             dropDead(add->e2, usage, slots, depth));
+  } else if (isinstanceof<Nameless::Mul>(eptr)) {
+    Nameless::Mul *mul = static_cast<Nameless::Mul *>(eptr);
+    return new Nameless::Mul(dropDead(mul->e1, usage, slots, depth),
+                             dropDead(mul->e2, usage, slots, depth));
+  } else if (isinstanceof<Nameless::Let>(eptr)) {
+    Nameless::Let *let = static_cast<Nameless::Let *>(eptr);
+    if (usage.dead.count(let)) {
+      slots.push_back(-1);
+      Nameless::Expr *body = dropDead(let->e2, usage, slots, depth);
+      slots.pop_back();
+      return body;
+    }
+    Nameless::Expr *e1 = dropDead(let->e1, usage, slots, depth);
+    slots.push_back(depth);
+    Nameless::Expr *e2 = dropDead(let->e2, usage, slots, depth + 1);
+    slots.pop_back();
+    return new Nameless::Let(e1, e2);
+  } else if (isinstanceof<Nameless::Fn>(eptr)) {
+    Nameless::Fn *fn = static_cast<Nameless::Fn *>(eptr);
+    for (int i = 0; i < fn->arity; i++) {
+      slots.push_back(depth + i);
+    }
+    Nameless::Expr *body =
+        dropDead(fn->expr, usage, slots, depth + fn->arity);
+    slots.resize(slots.size() - fn->arity);
+    return new Nameless::Fn(body, fn->arity);
+  } else if (isinstanceof<Nameless::App>(eptr)) {
+    Nameless::App *app = static_cast<Nameless::App *>(eptr);
+    std::vector<Nameless::Expr *> arguments;
+    for (Nameless::Expr *argument : app->arguments) {
+      arguments.push_back(dropDead(argument, usage, slots, depth));
+    }
+    return new Nameless::App(dropDead(app->expr, usage, slots, depth),
+                             std::move(arguments));
+  }
+  ALARM("Unsupported Nameless::Expr in dropDead: " + eptr->expr_name());
+}
+
+// Removes every Let whose slot is never read and whose right-hand side is
+// pure, including bindings only read by other removed ones. Arithmetic on
+// operands not known to be ints is kept, since it can still fail at run
+// time. Like specialize, it assumes every closure is called with its own
+// arity, which Nameless::typecheck checks. Run it before
+// Compiler::lowerFromNamelessToInstruction so that no code is emitted for
+// them. `depth` is the size of the env eptr runs in.
+Nameless::Expr *eliminateDeadLets(Nameless::Expr *eptr, int depth) {
+  Usage usage;
+  usage.binders.resize(depth, nullptr);
+  usage.ints.resize(depth, false);
+  countReads(eptr, usage, 1);
+  markDead(eptr, usage);
+  if (usage.dead.empty()) {
+    return eptr;
+  }
+  std::vector<int> slots;
+  for (int i = 0; i < depth; i++) {
+    slots.push_back(i);
+  }
+  return dropDead(eptr, usage, slots, depth);
+}
+
+} // namespace Optimizer
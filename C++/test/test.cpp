@@ -149,4 +149,738 @@ int main() {
     std::cout << "eval should be: " << Nameless::eval_final(nLet2, {})
               << std::endl;
   }
+
+  {
+    // Test 4: bytecode round trip
+    /*
+    let var2 = 2 in
+      var2 * (let var1 = 5 in (var1 + 2) * 4)
+    */
+    std::cout << "========== Test 4 ==========" << std::endl;
+    Expr::Add *add1 = new Expr::Add(new Expr::Var("var1"), new Expr::Cst(2));
+    Expr::Mul *mul1 = new Expr::Mul(add1, new Expr::Cst(4));
+    Expr::Let *let1 = new Expr::Let("var1", new Expr::Cst(5), mul1);
+    Expr::Mul *mul2 = new Expr::Mul(new Expr::Var("var2"), let1);
+    Expr::Let *let2 = new Expr::Let("var2", new Expr::Cst(2), mul2);
+
+    Nameless::Expr *nLet2 = Compiler::lowerFromExprToNameless(let2, {});
+    Instruction::InstrPtrs instrs =
+        Compiler::lowerFromNamelessToInstruction(nLet2, {});
+    int expected = Instruction::eval(instrs, {});
+
+    std::string bytes = Bytecode::serialize(instrs);
+    Bytecode::write("testExpr.scbc", bytes);
+    {
+      Bytecode::MappedFile file("testExpr.scbc");
+      Bytecode::Program program = file.program();
+      ASSERT(Instruction::to_str(Bytecode::decode(program)) ==
+                 Instruction::to_str(instrs),
+             "decoded bytecode differs from the serialized instructions");
+      int result = Bytecode::eval(program, {});
+      std::cout << "eval should be " << expected
+                << ", and the bytecode result is " << result << std::endl;
+      ASSERT(result == expected, "bytecode eval mismatch");
+    }
+    std::remove("testExpr.scbc");
+
+    std::string corrupted = bytes;
+    corrupted[corrupted.size() - 1] ^= 1;
+    bool rejected = false;
+    try {
+      Bytecode::load(corrupted.data(), corrupted.size());
+    } catch (const std::logic_error &) {
+      rejected = true;
+    }
+    std::cout << "corrupted bytecode is rejected: " << rejected << std::endl;
+    ASSERT(rejected, "corrupted bytecode passed the checksum");
+
+    // a well-formed file whose program underflows the stack
+    std::string underflowing = Bytecode::serialize(Instruction::InstrPtrs{
+        new Instruction::Cst(1), new Instruction::Swap(),
+        new Instruction::Pop(), new Instruction::Pop(),
+        new Instruction::Cst(2)});
+    rejected = false;
+    try {
+      Bytecode::eval(
+          Bytecode::load(underflowing.data(), underflowing.size()), {});
+    } catch (const std::logic_error &) {
+      rejected = true;
+    }
+    std::cout << "underflowing bytecode is rejected: " << rejected
+              << std::endl;
+    ASSERT(rejected, "underflowing bytecode was executed");
+  }
+#ifdef SC_PROFILE
+  {
+    // Test 5: profiling counters
+    /*
+    let b = 1 in
+      let a = fn(x, y){x + y} in
+        a(b, 2 * 3) * a(b, b)
+    */
+    std::cout << "========== Test 5 ==========" << std::endl;
+    Expr::Fn *fn1 = new Expr::Fn(
+        std::vector<std::string>{"x", "y"},
+        new Expr::Add(new Expr::Var("x"), new Expr::Var("y")));
+    Expr::App *app1 = new Expr::App(
+        new Expr::Var("a"),
+        std::vector<Expr::STRING_OR_EXPR>{
+            "b", new Expr::Mul(new Expr::Cst(2), new Expr::Cst(3))});
+    Expr::App *app2 = new Expr::App(new Expr::Var("a"),
+                                    std::vector<Expr::STRING_OR_EXPR>{"b", "b"});
+    Expr::Let *let1 = new Expr::Let("a", fn1, new Expr::Mul(app1, app2));
+    Expr::Let *let2 = new Expr::Let("b", new Expr::Cst(1), let1);
+    Nameless::Expr *nLet2 = Compiler::lowerFromExprToNameless(let2, {});
+
+    Profile::reset();
+    ASSERT(Expr::eval_final(let2, {}) == 14, "Expr eval mismatch");
+    ASSERT(Nameless::eval_final(nLet2, {}) == 14, "Nameless eval mismatch");
+    // let x = 3 in x * x
+    int result = Instruction::eval(
+        {new Instruction::Cst(3), new Instruction::Var(0),
+         new Instruction::Var(1), new Instruction::Mul(),
+         new Instruction::Swap(),
+         new Instruction::Pop()},
+        {});
+    ASSERT(result == 9, "Instruction eval mismatch");
+
+    auto counts = Profile::kind_counts();
+    std::cout << Profile::to_json() << std::endl;
+    std::cout << Profile::hot_list(5);
+    ASSERT(counts["Expr"]["App"] == 2 && counts["Nameless"]["App"] == 2,
+           "wrong App execution count");
+    ASSERT(counts["Nameless"]["Add"] == 2, "wrong Add execution count");
+    ASSERT(counts["Instruction"]["Mul"] == 1, "wrong Mul opcode count");
+    ASSERT(Profile::allocations["Nameless.Vclosure"] == 1,
+           "wrong closure allocation count");
+    ASSERT(Profile::max_depth["Instruction.stack"] == 3,
+           "wrong maximum stack depth");
+    ASSERT(Profile::max_depth["Nameless.env"] == 3,
+           "wrong maximum env depth");
+    ASSERT(Profile::closures.size() == 2 &&
+               Profile::closures[fn1->expr].calls == 2,
+           "wrong closure timing entries");
+  }
+#endif
+  {
+    // Test 6: values are reclaimed after each evaluation
+    /*
+    let b = 1 in
+      let a = fn(x, y){x + y} in
+        a(b, 2 * 3)
+    */
+    std::cout << "========== Test 6 ==========" << std::endl;
+    Expr::Fn *fn1 = new Expr::Fn(
+        std::vector<std::string>{"x", "y"},
+        new Expr::Add(new Expr::Var("x"), new Expr::Var("y")));
+    Expr::App *app1 = new Expr::App(
+        new Expr::Var("a"),
+        std::vector<Expr::STRING_OR_EXPR>{
+            "b", new Expr::Mul(new Expr::Cst(2), new Expr::Cst(3))});
+    Expr::Let *let1 = new Expr::Let("a", fn1, app1);
+    Expr::Let *let2 = new Expr::Let("b", new Expr::Cst(1), let1);
+    Nameless::Expr *nLet2 = Compiler::lowerFromExprToNameless(let2, {});
+
+    auto rss_kb = []() {
+      long pages = 0, resident = 0;
+      FILE *statm = fopen("/proc/self/statm", "r");
+      if (statm != nullptr) {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+          resident = 0;
+        }
+        fclose(statm);
+      }
+      return resident * (sysconf(_SC_PAGESIZE) / 1024);
+    };
+
+    const int iterations = 20000;
+    long rss_before = rss_kb();
+    for (int i = 0; i < iterations; i++) {
+      ASSERT(Expr::eval_final(let2, {}) == 7, "Expr eval mismatch");
+      ASSERT(Nameless::eval_final(nLet2, {}) == 7, "Nameless eval mismatch");
+    }
+    long rss_after = rss_kb();
+
+    std::cout << "Expr heap: allocated " << Expr::heap.stats.allocated
+              << ", live " << Expr::heap.stats.live << ", peak "
+              << Expr::heap.stats.peak_live << std::endl;
+    std::cout << "Nameless heap: allocated " << Nameless::heap.stats.allocated
+              << ", live " << Nameless::heap.stats.live << ", peak "
+              << Nameless::heap.stats.peak_live << std::endl;
+    std::cout << "RSS before " << rss_before << " KB, after " << rss_after
+              << " KB" << std::endl;
+    ASSERT(Expr::heap.stats.live == 0 && Nameless::heap.stats.live == 0,
+           "values outlived their evaluation");
+    ASSERT(Nameless::heap.stats.freed == Nameless::heap.stats.allocated,
+           "not every allocated value was freed");
+    ASSERT(rss_after - rss_before < 4096, "RSS grew during the soak test");
+  }
+  {
+    // Test 7: printing a deep spine
+    std::cout << "========== Test 7 ==========" << std::endl;
+    const int depth = 100000;
+    Nameless::Expr *spine = new Nameless::Var(depth - 1);
+    for (int i = 0; i < depth; i++) {
+      spine = new Nameless::Let(new Nameless::Cst(i % 10), spine);
+    }
+    std::ostringstream oss;
+    Nameless::print(oss, spine);
+    std::string text = oss.str();
+    std::cout << "printed " << text.size() << " characters" << std::endl;
+    ASSERT(text == Nameless::to_str(spine), "print and to_str differ");
+    ASSERT(text.compare(0, 20, "let 9 in let 8 in le") == 0 &&
+               text.compare(text.size() - 10, 10, "Var(99999)") == 0,
+           "deep spine printed incorrectly");
+
+    Expr::App *app1 = new Expr::App(
+        new Expr::Var("f"),
+        std::vector<Expr::STRING_OR_EXPR>{"x", new Expr::Cst(1)});
+    ASSERT(Expr::to_str(app1) == "f(x, 1)", "App printed incorrectly");
+  }
+  {
+    // Test 8: specializing for a known free variable
+    /*
+    rate and req are free, rate is fixed to 5
+    let scale = fn(x, y){x * y} in
+      let base = rate * 2 in
+        scale(rate, req + base)
+    */
+    std::cout << "========== Test 8 ==========" << std::endl;
+    Expr::Fn *fn1 = new Expr::Fn(
+        std::vector<std::string>{"x", "y"},
+        new Expr::Mul(new Expr::Var("x"), new Expr::Var("y")));
+    Expr::App *app1 = new Expr::App(
+        new Expr::Var("scale"),
+        std::vector<Expr::STRING_OR_EXPR>{
+            "rate",
+            new Expr::Add(new Expr::Var("req"), new Expr::Var("base"))});
+    Expr::Let *let1 = new Expr::Let(
+        "base", new Expr::Mul(new Expr::Var("rate"), new Expr::Cst(2)), app1);
+    Expr::Let *let2 = new Expr::Let("scale", fn1, let1);
+    Nameless::Expr *nLet2 =
+        Compiler::lowerFromExprToNameless(let2, {"rate", "req"});
+
+    Nameless::Expr *residual = Optimizer::specialize(nLet2, {{0, 5}}, 2);
+    std::cout << "Nameless expression is \"" << Nameless::to_str(nLet2) << "\""
+              << std::endl;
+    std::cout << "Residual expression is \"" << Nameless::to_str(residual)
+              << "\"" << std::endl;
+    ASSERT(Nameless::to_str(residual) == "let Var(0) + 10 in 5 * Var(1)",
+           "unexpected residual program");
+
+    int expected = Nameless::eval_final(
+        nLet2, {new Nameless::Vint(5), new Nameless::Vint(3)});
+    int specialized = Nameless::eval_final(residual, {new Nameless::Vint(3)});
+    // bind req = 3 around the residual program to close it
+    int compiled = Instruction::eval(
+        Compiler::lowerFromNamelessToInstruction(
+            new Nameless::Let(new Nameless::Cst(3), residual), {}),
+        {});
+    std::cout << "eval should be " << expected << ", and the results are "
+              << specialized << " and " << compiled << std::endl;
+    ASSERT(specialized == expected && compiled == expected,
+           "residual program computes a different value");
+
+    // let w = fn(x){x(x)} in w(w) must still specialize
+    Nameless::Fn *w = new Nameless::Fn(
+        new Nameless::App(new Nameless::Var(0),
+                          std::vector<Nameless::Expr *>{new Nameless::Var(0)}),
+        1);
+    Nameless::App *app2 = new Nameless::App(
+        new Nameless::Var(0),
+        std::vector<Nameless::Expr *>{new Nameless::Var(0)});
+    Nameless::Let *omega = new Nameless::Let(w, app2);
+    Optimizer::specialize(omega, {}, 0);
+
+    // let-bound arguments of an unfolded call are relocated
+    /*
+    r is free
+    let a = fn(x, y){x * y} in
+      a(r + 2, let t = r + 1 in t * t)
+    */
+    Nameless::Fn *fn3 = new Nameless::Fn(
+        new Nameless::Mul(new Nameless::Var(1), new Nameless::Var(2)), 2);
+    Nameless::Let *square = new Nameless::Let(
+        new Nameless::Add(new Nameless::Var(0), new Nameless::Cst(1)),
+        new Nameless::Mul(new Nameless::Var(2), new Nameless::Var(2)));
+    Nameless::App *app3 = new Nameless::App(
+        new Nameless::Var(1),
+        std::vector<Nameless::Expr *>{
+            new Nameless::Add(new Nameless::Var(0), new Nameless::Cst(2)),
+            square});
+    Nameless::Let *let3 = new Nameless::Let(fn3, app3);
+    Nameless::Expr *residual2 = Optimizer::specialize(let3, {}, 1);
+    ASSERT(Nameless::eval_final(residual2, {new Nameless::Vint(3)}) == 80 &&
+               Nameless::eval_final(let3, {new Nameless::Vint(3)}) == 80,
+           "specialized arguments were bound at the wrong depth");
+
+    // let w = fn(x){x(x) + x(x)} in w(w) branches at every unfolding
+    Nameless::Fn *w2 = new Nameless::Fn(
+        new Nameless::Add(
+            new Nameless::App(new Nameless::Var(0),
+                              std::vector<Nameless::Expr *>{
+                                  new Nameless::Var(0)}),
+            new Nameless::App(new Nameless::Var(0),
+                              std::vector<Nameless::Expr *>{
+                                  new Nameless::Var(0)})),
+        1);
+    Nameless::Let *omega2 = new Nameless::Let(
+        w2, new Nameless::App(new Nameless::Var(0),
+                              std::vector<Nameless::Expr *>{
+                                  new Nameless::Var(0)}));
+    ASSERT(Nameless::size(Optimizer::specialize(omega2, {}, 0)) <=
+               (Optimizer::RESIDUAL_GROWTH + 1) * Nameless::size(omega2),
+           "branching self-application grew the residual program");
+
+    /*
+    r is free
+    let f0 = fn(x){x + x} in
+      let f1 = fn(x){f0(x) + f0(x)} in
+        ...
+          f16(r)
+    */
+    const int links = 16;
+    Nameless::Expr *doubling = new Nameless::App(
+        new Nameless::Var(links + 1),
+        std::vector<Nameless::Expr *>{new Nameless::Var(0)});
+    for (int i = links; i >= 0; i--) {
+      // f_i's parameter is slot i + 1, and f_{i-1} is slot i
+      Nameless::Expr *x = new Nameless::Var(i + 1);
+      Nameless::Expr *body =
+          i == 0 ? (Nameless::Expr *)new Nameless::Add(x, x)
+                 : new Nameless::Add(
+                       new Nameless::App(new Nameless::Var(i),
+                                         std::vector<Nameless::Expr *>{x}),
+                       new Nameless::App(new Nameless::Var(i),
+                                         std::vector<Nameless::Expr *>{x}));
+      doubling = new Nameless::Let(new Nameless::Fn(body, 1), doubling);
+    }
+    Nameless::Expr *residual3 = Optimizer::specialize(doubling, {}, 1);
+    std::cout << "doubling chain of " << Nameless::size(doubling)
+              << " nodes specializes to " << Nameless::size(residual3)
+              << " nodes" << std::endl;
+    ASSERT(Nameless::size(residual3) <=
+               (Optimizer::RESIDUAL_GROWTH + 1) * Nameless::size(doubling),
+           "the residual program grew past its budget");
+    ASSERT(Nameless::eval_final(residual3, {new Nameless::Vint(3)}) ==
+               Nameless::eval_final(doubling, {new Nameless::Vint(3)}),
+           "specializing the doubling chain changed the result");
+
+    // let f = fn(){1} in f(0) has no faithful residual and is rejected
+    Nameless::Let *let4 = new Nameless::Let(
+        new Nameless::Fn(new Nameless::Cst(1), 0),
+        new Nameless::App(new Nameless::Var(0),
+                          std::vector<Nameless::Expr *>{new Nameless::Cst(0)}));
+    bool rejected = false;
+    try {
+      Optimizer::specialize(let4, {}, 0);
+    } catch (const std::logic_error &) {
+      rejected = true;
+    }
+    std::cout << "mismatched call is rejected: " << rejected << std::endl;
+    ASSERT(rejected, "a call with the wrong number of arguments specialized");
+  }
+  {
+    // Test 9: inlining let-bound closures
+    /*
+    let b = 1 in
+      let c = 2 * 3 in
+        let a = fn(x, y){x + y} in
+          a(b, c)
+    */
+    std::cout << "========== Test 9 ==========" << std::endl;
+    Expr::Fn *fn1 = new Expr::Fn(
+        std::vector<std::string>{"x", "y"},
+        new Expr::Add(new Expr::Var("x"), new Expr::Var("y")));
+    Expr::App *app1 = new Expr::App(
+        new Expr::Var("a"), std::vector<Expr::STRING_OR_EXPR>{"b", "c"});
+    Expr::Let *let1 = new Expr::Let("a", fn1, app1);
+    Expr::Let *let2 = new Expr::Let(
+        "c", new Expr::Mul(new Expr::Cst(2), new Expr::Cst(3)), let1);
+    Expr::Let *let3 = new Expr::Let("b", new Expr::Cst(1), let2);
+    Nameless::Expr *nLet3 = Compiler::lowerFromExprToNameless(let3, {});
+    Nameless::Expr *inlined = Optimizer::inlineClosures(nLet3, 0);
+    std::cout << "Inlined expression is \"" << Nameless::to_str(inlined)
+              << "\"" << std::endl;
+    ASSERT(Nameless::to_str(inlined) == "let 1 in let 2 * 3 in Var(0) + Var(1)",
+           "unexpected inlined program");
+
+    uint64_t allocated = Nameless::heap.stats.allocated;
+    ASSERT(Nameless::eval_final(nLet3, {}) == 7, "Nameless eval mismatch");
+    uint64_t original_allocations = Nameless::heap.stats.allocated - allocated;
+    allocated = Nameless::heap.stats.allocated;
+    ASSERT(Nameless::eval_final(inlined, {}) == 7, "inlined eval mismatch");
+    uint64_t inlined_allocations = Nameless::heap.stats.allocated - allocated;
+    std::cout << "values allocated: " << original_allocations << " before, "
+              << inlined_allocations << " after inlining" << std::endl;
+    ASSERT(inlined_allocations < original_allocations,
+           "inlining did not reduce allocations");
+#ifdef SC_PROFILE
+    Profile::reset();
+    Nameless::eval_final(inlined, {});
+    ASSERT(Profile::allocations["Nameless.Vclosure"] == 0,
+           "inlined program still allocates closures");
+#endif
+
+    /*
+    let a = fn(x, y){x * y} in
+      let z = 10 in
+        a(z + 2, a(1, z))
+    */
+    Nameless::Fn *fn2 = new Nameless::Fn(
+        new Nameless::Mul(new Nameless::Var(0), new Nameless::Var(1)), 2);
+    Nameless::App *inner = new Nameless::App(
+        new Nameless::Var(0),
+        std::vector<Nameless::Expr *>{new Nameless::Cst(1),
+                                      new Nameless::Var(1)});
+    Nameless::App *outer = new Nameless::App(
+        new Nameless::Var(0),
+        std::vector<Nameless::Expr *>{
+            new Nameless::Add(new Nameless::Var(1), new Nameless::Cst(2)),
+            inner});
+    Nameless::Let *let4 =
+        new Nameless::Let(fn2, new Nameless::Let(new Nameless::Cst(10), outer));
+    Nameless::Expr *inlined2 = Optimizer::inlineClosures(let4, 0);
+    std::cout << "Inlined expression is \"" << Nameless::to_str(inlined2)
+              << "\"" << std::endl;
+    ASSERT(Nameless::eval_final(inlined2, {}) ==
+               Nameless::eval_final(let4, {}),
+           "nested inlining changed the result");
+    ASSERT(Nameless::to_str(inlined2).find("Fn") == std::string::npos,
+           "nested calls were not inlined");
+
+    // a closure passed as an argument escapes and is kept
+    Nameless::Let *let5 = new Nameless::Let(
+        fn2, new Nameless::App(new Nameless::Fn(new Nameless::Var(1), 1),
+                               std::vector<Nameless::Expr *>{
+                                   new Nameless::Var(0)}));
+    ASSERT(Nameless::to_str(Optimizer::inlineClosures(let5, 0)) ==
+               Nameless::to_str(let5),
+           "an escaping closure was inlined");
+  }
+  {
+    // Test 10: type checking and verified evaluation
+    /*
+    let b = 1 in
+      let a = fn(x, y){x + y} in
+        let id = fn(f){f} in
+          id(a)(b, 2 * 3)
+    */
+    std::cout << "========== Test 10 ==========" << std::endl;
+    Expr::Fn *fn1 = new Expr::Fn(
+        std::vector<std::string>{"x", "y"},
+        new Expr::Add(new Expr::Var("x"), new Expr::Var("y")));
+    Expr::Fn *id = new Expr::Fn(std::vector<std::string>{"f"},
+                                new Expr::Var("f"));
+    Expr::App *app1 = new Expr::App(
+        new Expr::App(new Expr::Var("id"),
+                      std::vector<Expr::STRING_OR_EXPR>{"a"}),
+        std::vector<Expr::STRING_OR_EXPR>{
+            "b", new Expr::Mul(new Expr::Cst(2), new Expr::Cst(3))});
+    Expr::Let *let1 = new Expr::Let("id", id, app1);
+    Expr::Let *let2 = new Expr::Let("a", fn1, let1);
+    Expr::Let *let3 = new Expr::Let("b", new Expr::Cst(1), let2);
+    Nameless::Expr *nLet3 = Compiler::lowerFromExprToNameless(let3, {});
+
+    ASSERT(isinstanceof<Expr::Tint>(Expr::typecheck(let3, {})),
+           "Expr program should have type int");
+    ASSERT(isinstanceof<Nameless::Tint>(Nameless::typecheck(nLet3, {})),
+           "Nameless program should have type int");
+    int checked = Nameless::eval_final(nLet3, {});
+    int verified = Nameless::eval_final_verified(nLet3, {});
+    std::cout << "checked eval is " << checked << ", verified eval is "
+              << verified << std::endl;
+    ASSERT(checked == 7 && verified == 7 &&
+               Expr::eval_final_verified(let3, {}) == 7,
+           "verified eval mismatch");
+
+    auto rejects = [](auto check) {
+      try {
+        check();
+      } catch (const std::logic_error &ex) {
+        std::cout << "rejected: " << ex.what() << std::endl;
+        return true;
+      }
+      return false;
+    };
+    // let f = fn(x){x} in f + 1
+    Expr::Let *bad1 = new Expr::Let(
+        "f",
+        new Expr::Fn(std::vector<std::string>{"x"}, new Expr::Var("x")),
+        new Expr::Add(new Expr::Var("f"), new Expr::Cst(1)));
+    Nameless::Expr *nBad1 = Compiler::lowerFromExprToNameless(bad1, {});
+    // let f = fn(x){x} in f(1, 2)
+    Nameless::Let *bad2 = new Nameless::Let(
+        new Nameless::Fn(new Nameless::Var(0), 1),
+        new Nameless::App(new Nameless::Var(0),
+                          std::vector<Nameless::Expr *>{
+                              new Nameless::Cst(1), new Nameless::Cst(2)}));
+    ASSERT(rejects([&]() { Expr::typecheck(bad1, {}); }) &&
+               rejects([&]() { Nameless::typecheck(nBad1, {}); }) &&
+               rejects([&]() { Nameless::typecheck(bad2, {}); }),
+           "an ill-typed program was accepted");
+
+    // let f0 = fn(x){x + 1} in let f1 = fn(x){f0(1)} in ... f100(1)
+    // nests 101 calls, and is checked once per function
+    const int wrappers = 100;
+    Expr::Expr *chain = new Expr::App(
+        new Expr::Var("f" + std::to_string(wrappers)),
+        std::vector<Expr::STRING_OR_EXPR>{new Expr::Cst(1)});
+    for (int i = wrappers; i >= 0; i--) {
+      Expr::Expr *body =
+          i == 0 ? (Expr::Expr *)new Expr::Add(new Expr::Var("x"),
+                                               new Expr::Cst(1))
+                 : new Expr::App(
+                       new Expr::Var("f" + std::to_string(i - 1)),
+                       std::vector<Expr::STRING_OR_EXPR>{new Expr::Cst(1)});
+      chain = new Expr::Let(
+          "f" + std::to_string(i),
+          new Expr::Fn(std::vector<std::string>{"x"}, body), chain);
+    }
+    Nameless::Expr *nChain = Compiler::lowerFromExprToNameless(chain, {});
+    ASSERT(isinstanceof<Expr::Tint>(Expr::typecheck(chain, {})) &&
+               isinstanceof<Nameless::Tint>(Nameless::typecheck(nChain, {})),
+           "deeply nested calls were rejected");
+    ASSERT(Expr::eval_final_verified(chain, {}) == 2 &&
+               Nameless::eval_final_verified(nChain, {}) == 2,
+           "verified eval of nested calls mismatch");
+
+    /*
+    let compose = fn(f, g){fn(x){f(g(x))}} in
+      let inc = fn(x){x + 1} in
+        let c0 = inc in
+          let c1 = compose(c0, inc) in
+            ...
+              c70(0)
+    */
+    // the body of fn(x) nests 71 times, in a different env each time
+    const int links = 70;
+    Nameless::Expr *composed = new Nameless::App(
+        new Nameless::Var(links + 2),
+        std::vector<Nameless::Expr *>{new Nameless::Cst(0)});
+    for (int i = links; i >= 1; i--) {
+      composed = new Nameless::Let(
+          new Nameless::App(new Nameless::Var(0),
+                            std::vector<Nameless::Expr *>{
+                                new Nameless::Var(i + 1),
+                                new Nameless::Var(1)}),
+          composed);
+    }
+    Nameless::Fn *compose = new Nameless::Fn(
+        new Nameless::Fn(
+            new Nameless::App(
+                new Nameless::Var(0),
+                std::vector<Nameless::Expr *>{new Nameless::App(
+                    new Nameless::Var(1),
+                    std::vector<Nameless::Expr *>{new Nameless::Var(2)})}),
+            1),
+        2);
+    Nameless::Fn *inc = new Nameless::Fn(
+        new Nameless::Add(new Nameless::Var(1), new Nameless::Cst(1)), 1);
+    composed = new Nameless::Let(
+        compose,
+        new Nameless::Let(inc,
+                          new Nameless::Let(new Nameless::Var(1), composed)));
+    ASSERT(isinstanceof<Nameless::Tint>(Nameless::typecheck(composed, {})),
+           "a long compose chain was rejected");
+    ASSERT(Nameless::eval_final_verified(composed, {}) == links + 1 &&
+               Nameless::eval_final(composed, {}) == links + 1,
+           "verified eval of the compose chain mismatch");
+
+    // let w = fn(x){x(x)} in w(w) never returns
+    Nameless::Let *omega = new Nameless::Let(
+        new Nameless::Fn(new Nameless::App(new Nameless::Var(0),
+                                           std::vector<Nameless::Expr *>{
+                                               new Nameless::Var(0)}),
+                         1),
+        new Nameless::App(new Nameless::Var(0),
+                          std::vector<Nameless::Expr *>{new Nameless::Var(0)}));
+    ASSERT(rejects([&]() { Nameless::typecheck(omega, {}); }),
+           "a non-terminating program was accepted");
+
+    Expr::Let *let4 = new Expr::Let(
+        "x", new Expr::Cst(3),
+        new Expr::Mul(new Expr::Var("x"),
+                      new Expr::Add(new Expr::Var("x"), new Expr::Cst(4))));
+    Instruction::InstrPtrs instrs = Compiler::lowerFromNamelessToInstruction(
+        Compiler::lowerFromExprToNameless(let4, {}), {});
+    size_t max_depth = Instruction::verify(instrs);
+    std::cout << "max stack depth is " << max_depth << std::endl;
+    ASSERT(max_depth == 4, "wrong maximum stack depth");
+    ASSERT(Instruction::eval_verified(instrs, {}, max_depth) == 21 &&
+               Instruction::eval(instrs, {}) == 21,
+           "verified instruction eval mismatch");
+    ASSERT(rejects([]() {
+             Instruction::verify(
+                 {new Instruction::Cst(1), new Instruction::Add()});
+           }),
+           "a stack underflow was accepted");
+  }
+  {
+    // Test 11: flat node pool
+    /*
+    let b = 1 in
+      let a = fn(x, y){x * y} in
+        a(b + 2, a(3, b))
+    */
+    std::cout << "========== Test 11 ==========" << std::endl;
+    Expr::Fn *fn1 = new Expr::Fn(
+        std::vector<std::string>{"x", "y"},
+        new Expr::Mul(new Expr::Var("x"), new Expr::Var("y")));
+    Expr::App *inner = new Expr::App(
+        new Expr::Var("a"),
+        std::vector<Expr::STRING_OR_EXPR>{new Expr::Cst(3), "b"});
+    Expr::App *outer = new Expr::App(
+        new Expr::Var("a"),
+        std::vector<Expr::STRING_OR_EXPR>{
+            new Expr::Add(new Expr::Var("b"), new Expr::Cst(2)), inner});
+    Expr::Let *let1 = new Expr::Let(
+        "b", new Expr::Cst(1), new Expr::Let("a", fn1, outer));
+    Nameless::Expr *nLet1 = Compiler::lowerFromExprToNameless(let1, {});
+
+    Flat::Pool pool;
+    uint32_t root = Flat::fromNameless(pool, nLet1);
+    std::cout << "pool holds " << pool.size() << " nodes in " << pool.bytes()
+              << " bytes" << std::endl;
+    ASSERT(Nameless::to_str(Flat::toNameless(pool, root)) ==
+               Nameless::to_str(nLet1),
+           "flat round trip changed the program");
+    int expected = Nameless::eval_final(nLet1, {});
+    int result = Flat::eval_final(pool, root, {});
+    std::cout << "eval should be " << expected << ", and the flat result is "
+              << result << std::endl;
+    ASSERT(result == expected, "flat eval mismatch");
+
+    // let x = 3 in x * (let y = x + 4 in y * y)
+    Nameless::Let *let2 = new Nameless::Let(
+        new Nameless::Cst(3),
+        new Nameless::Mul(
+            new Nameless::Var(0),
+            new Nameless::Let(
+                new Nameless::Add(new Nameless::Var(0), new Nameless::Cst(4)),
+                new Nameless::Mul(new Nameless::Var(1),
+                                  new Nameless::Var(1)))));
+    Flat::Pool pool2;
+    uint32_t root2 = Flat::fromNameless(pool2, let2);
+    Instruction::InstrPtrs instrs =
+        Compiler::lowerFromFlatToInstruction(pool2, root2, {});
+    ASSERT(Instruction::to_str(instrs) ==
+               Instruction::to_str(
+                   Compiler::lowerFromNamelessToInstruction(let2, {})),
+           "flat lowering differs from tree lowering");
+    ASSERT(Instruction::eval(instrs, {}) == 147, "flat lowering mismatch");
+  }
+  {
+    // Test 12: dead bindings and call-by-need evaluation
+    /*
+    let a = 2 * 3 in
+      let b = a + 1 in
+        let c = 5 in
+          let f = fn(x){let y = x in x} in
+            let u = f(c) in
+              c * 2
+    */
+    std::cout << "========== Test 12 ==========" << std::endl;
+    Nameless::Fn *f = new Nameless::Fn(
+        new Nameless::Let(new Nameless::Var(3), new Nameless::Var(3)), 1);
+    Nameless::App *app1 = new Nameless::App(
+        new Nameless::Var(3),
+        std::vector<Nameless::Expr *>{new Nameless::Var(2)});
+    Nameless::Expr *program = new Nameless::Let(
+        new Nameless::Mul(new Nameless::Cst(2), new Nameless::Cst(3)),
+        new Nameless::Let(
+            new Nameless::Add(new Nameless::Var(0), new Nameless::Cst(1)),
+            new Nameless::Let(
+                new Nameless::Cst(5),
+                new Nameless::Let(
+                    f, new Nameless::Let(app1, new Nameless::Mul(
+                                                   new Nameless::Var(2),
+                                                   new Nameless::Cst(2)))))));
+    Nameless::Expr *live = Optimizer::eliminateDeadLets(program, 0);
+    std::cout << "Expression is \"" << Nameless::to_str(program) << "\""
+              << std::endl;
+    std::cout << "Without dead bindings \"" << Nameless::to_str(live) << "\""
+              << std::endl;
+    // u is an application, so it is kept along with f and c
+    ASSERT(Nameless::to_str(live) ==
+               "let 5 in let Fn{Var(1)} in let Var(1)(Var(0)) in Var(0) * 2",
+           "unexpected program without dead bindings");
+    ASSERT(Nameless::eval_final(live, {}) == 10 &&
+               Nameless::eval_final(program, {}) == 10,
+           "dead binding elimination changed the result");
+
+    // let a = 2 * 3 in let b = a + 1 in let c = 5 in c * 2
+    Nameless::Expr *arith = new Nameless::Let(
+        new Nameless::Mul(new Nameless::Cst(2), new Nameless::Cst(3)),
+        new Nameless::Let(
+            new Nameless::Add(new Nameless::Var(0), new Nameless::Cst(1)),
+            new Nameless::Let(new Nameless::Cst(5),
+                              new Nameless::Mul(new Nameless::Var(2),
+                                                new Nameless::Cst(2)))));
+    Instruction::InstrPtrs before =
+        Compiler::lowerFromNamelessToInstruction(arith, {});
+    Instruction::InstrPtrs after = Compiler::lowerFromNamelessToInstruction(
+        Optimizer::eliminateDeadLets(arith, 0), {});
+    std::cout << before.size() << " instructions before, " << after.size()
+              << " after" << std::endl;
+    ASSERT(after.size() == 6 && Instruction::eval(after, {}) == 10 &&
+               Instruction::eval(before, {}) == 10,
+           "dead bindings were still lowered");
+
+    // let f = fn(x){x} in let y = f + 1 in 5 fails at run time, and still
+    // does without dead bindings
+    Nameless::Expr *ill_typed = new Nameless::Let(
+        new Nameless::Fn(new Nameless::Var(0), 1),
+        new Nameless::Let(
+            new Nameless::Add(new Nameless::Var(0), new Nameless::Cst(1)),
+            new Nameless::Cst(5)));
+    Nameless::Expr *kept = Optimizer::eliminateDeadLets(ill_typed, 0);
+    bool failed = false;
+    try {
+      Nameless::eval_final(kept, {});
+    } catch (const std::logic_error &) {
+      failed = true;
+    }
+    std::cout << "ill-typed binding is kept: " << failed << std::endl;
+    ASSERT(failed && Nameless::to_str(kept) == Nameless::to_str(ill_typed),
+           "a binding that fails at run time was removed");
+
+    /*
+    let g = fn(x){x} in
+      let k = fn(x, y){y} in
+        k(g + 1, 5)
+    */
+    Nameless::App *app2 = new Nameless::App(
+        new Nameless::Var(1),
+        std::vector<Nameless::Expr *>{
+            new Nameless::Add(new Nameless::Var(0), new Nameless::Cst(1)),
+            new Nameless::Cst(5)});
+    Nameless::Expr *unused_arg = new Nameless::Let(
+        new Nameless::Fn(new Nameless::Var(0), 1),
+        new Nameless::Let(new Nameless::Fn(new Nameless::Var(2), 2), app2));
+    bool eager_failed = false;
+    try {
+      Nameless::eval_final(unused_arg, {});
+    } catch (const std::logic_error &) {
+      eager_failed = true;
+    }
+    int lazy = Nameless::eval_final_lazy(unused_arg, {});
+    std::cout << "eager eval fails: " << eager_failed << ", lazy eval is "
+              << lazy << std::endl;
+    ASSERT(eager_failed && lazy == 5, "the unused argument was evaluated");
+    ASSERT(Nameless::eval_final_lazy(program, {}) == 10,
+           "lazy eval mismatch");
+
+#ifdef SC_PROFILE
+    // let a = 1 + 2 in a * a evaluates 1 + 2 once
+    Nameless::Let *shared = new Nameless::Let(
+        new Nameless::Add(new Nameless::Cst(1), new Nameless::Cst(2)),
+        new Nameless::Mul(new Nameless::Var(0), new Nameless::Var(0)));
+    Profile::reset();
+    ASSERT(Nameless::eval_final_lazy(shared, {}) == 9, "lazy eval mismatch");
+    ASSERT(Profile::kind_counts()["Nameless"]["Add"] == 1 &&
+               Profile::allocations["Nameless.Vthunk"] == 1,
+           "the thunk was not memoized");
+#endif
+  }
 }
\ No newline at end of file